@@ -0,0 +1,521 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <limits>
+
+#include<boost/array.hpp>
+#include <boost/numeric/odeint.hpp>
+#include "steppers.h"
+#include "habituation_criteria.h"
+#include "counters.h"
+
+
+using namespace std;
+using namespace boost::numeric::odeint;
+
+
+// ------------------------------------
+// Protocol and solver settings. The defaults are the ones of
+// sensitivity_receptor_Ra/adaint_recovery.h
+// ------------------------------------
+struct adaint_options
+{
+    double ton;                 // stimulus duration within each period
+    double step_size;           // sampling step (and rk4 step) of the stimulation periods
+    double step_size_big;       // sampling step of the recovery relaxation
+    double int_threshold;       // relative change of two successive peaks that counts as habituated
+    double recovery_threshold;  // normalized test peak that counts as recovered
+    double max_periods;         // integration stops after max_periods*T
+    int recovery_depth;         // the recovery relaxation lasts T*2^recovery_depth
+    double min_level;           // states outside [min_level, max_level] reject the parameter set
+    double max_level;
+    double abs_tol;             // tolerances of the explicit controlled stepper
+    double rel_tol;
+    double stiff_abs_tol;       // tolerances of rosenbrock4
+    double stiff_rel_tol;
+    int stiff;                  // -1 takes Model::stiff, 0 forces the explicit, 1 the stiff stepper
+    int criterion;              // 0: two successive peaks (C++ copies), 1: adaint.py and calc_util.sliding_maxnorm_ht
+    // criterion 1 only, defaults of adaint.integrate
+    double min_output_level;
+    int steady_counter_threshold;
+    int increasing_counter_threshold;
+    int num_periods_per_expansion;
+    int max_expansion_attempts;
+    // trajectory written with print (see write_trajectory)
+    int print_every;            // every k-th sample
+    int print_periods;          // 1: only the period boundaries and the peaks
+    int print_recovery;         // 1: also the recovery relaxation (recovery_file_name)
+    int checkpoints;            // 1: keep only the phase starts of the habituation, the samples are replayed on demand (replay.h)
+    int recovery_slices;        // > 1: the recovery relaxation in that many time slices integrated in parallel (parareal.h)
+    double parareal_tol;        // Parareal stops when no slice start moves by more than this
+    int peak_events;            // 1: the peaks are located between the samples, where d output/dt = 0 (refine_peak)
+    // stepper of each phase (steppers.h: explicit_method, stiff_method,
+    // dopri5_method, rk4_method), -1: that of the run (stiff)
+    int on_method;              // ON phases of the habituation
+    int off_method;             // OFF phases of the habituation
+    int relax_method;           // recovery relaxation
+    int probe_method;           // test periods of the recovery
+    double rk4_step;            // step of rk4_method, 0: the sampling step
+    // screening (screening.h)
+    double screening_step;      // sampling step of the screening run (with peak events)
+    double screening_tol;       // tolerance of its relaxation and of rosenbrock4
+    double screening_margin;    // decisions within screening_margin*threshold of their threshold are verified with the options of the run
+    double screening_band;      // as are runs with a state within screening_band of min_level or max_level
+
+    adaint_options() : ton(1.0), step_size(0.001), step_size_big(0.01), int_threshold(0.01),
+        recovery_threshold(0.95), max_periods(50.0), recovery_depth(12), min_level(0.0), max_level(1.0),
+        abs_tol(1E-12), rel_tol(1E-12), stiff_abs_tol(1E-10), stiff_rel_tol(1E-10), stiff(-1),
+        criterion(0), min_output_level(1E-4), steady_counter_threshold(4), increasing_counter_threshold(10),
+        num_periods_per_expansion(10), max_expansion_attempts(3), print_every(1), print_periods(0), print_recovery(0),
+        checkpoints(0), recovery_slices(0), parareal_tol(1E-8), peak_events(0),
+        on_method(-1), off_method(-1), relax_method(-1), probe_method(-1), rk4_step(0.0),
+        screening_step(0.01), screening_tol(1E-8), screening_margin(0.01), screening_band(1E-12) { }
+};
+
+
+enum { two_peak_criterion = 0 , python_criterion = 1 };
+
+
+template< class Model >
+bool use_stiff_stepper( const adaint_options &opt )
+{
+    if( opt.stiff < 0 )
+        return Model::stiff;
+    return opt.stiff > 0;
+}
+
+
+// true if opt chooses the stepper of a phase
+inline bool phase_methods( const adaint_options &opt )
+{
+    return (opt.on_method >= 0) || (opt.off_method >= 0) || (opt.relax_method >= 0) || (opt.probe_method >= 0);
+}
+
+
+// stepper of a phase with method (-1: that of the run)
+template< class Model >
+configured_stepper phase_stepper( int method , const adaint_options &opt )
+{
+    if( method < 0 )
+        method = use_stiff_stepper< Model >( opt ) ? stiff_method : explicit_method;
+    return configured_stepper( method , opt.abs_tol , opt.rel_tol , opt.stiff_abs_tol , opt.stiff_rel_tol , opt.rk4_step );
+}
+
+
+typedef phase_steppers< configured_stepper > configured_steppers;
+
+
+// stepper policy of the methods of opt
+template< class Model >
+configured_steppers configured_policy( const adaint_options &opt )
+{
+    return configured_steppers( phase_stepper< Model >( opt.on_method , opt ) , phase_stepper< Model >( opt.off_method , opt ) ,
+                                phase_stepper< Model >( opt.relax_method , opt ) , phase_stepper< Model >( opt.probe_method , opt ) );
+}
+
+
+template< class State >
+bool state_out_of_bounds( const State &x , double min_level , double max_level )
+{
+    return (std::any_of(x.begin(), x.end(), [min_level](double y) { return y < min_level; })) || (std::any_of(x.begin(), x.end(), [max_level](double y) { return y > max_level; })) || (std::any_of(x.begin(), x.end(), [](double d) { return std::isnan(d); } ));
+}
+
+
+// Trajectory and peaks of the habituation protocol. With
+// opt.checkpoints x_vec, times and output_variable stay empty.
+template< class State >
+struct habituation_data
+{
+    vector< State > x_vec;
+    vector< double > times;
+    vector< double > output_variable;
+    vector< double > peaks_time;
+    vector< double > peaks_level;
+    vector< State > checkpoints;        // state at the start of the ON ([2k]) and OFF ([2k+1]) phase of period k+1
+    vector< double > checkpoint_times;
+    int ht;                     // periods integrated
+    int sliding_ht;             // calc_util.sliding_maxnorm_ht of the peaks
+};
+
+
+template< class Systems >
+struct push_back_trajectory
+{
+    typedef typename Systems::state_type state_type;
+
+    habituation_data< state_type > &m_data;
+    const Systems &m_s;
+    bool m_stimulated;
+
+    push_back_trajectory( habituation_data< state_type > &data , const Systems &s , bool stimulated ) : m_data( data ) , m_s( s ) , m_stimulated( stimulated ) { }
+
+    void operator()( const state_type &x , double t )
+    {
+        m_data.times.push_back( t );
+        m_data.x_vec.push_back( x );
+        m_data.output_variable.push_back( m_s.output_value( x , m_stimulated ) );
+    }
+};
+
+
+// First maximum of the output over a period. With keep the samples
+// before and after it are kept for refine_peak; the interval ending at
+// a sample belongs to the phase of that sample.
+template< class State >
+struct peak_samples
+{
+    double level;
+    double time;
+    bool keep;
+    State before , at , after;
+    double t_before , t_after;
+    bool has_before , has_after;
+    bool stimulated_at , stimulated_after;
+    State last;                 // last sample pushed
+    double t_last;
+    bool has_last;
+    bool want_after;
+
+    // period starting from x at t
+    void start( const State &x , double t , bool keep_samples )
+    {
+        level = -numeric_limits< double >::infinity();
+        time = t;
+        keep = keep_samples;
+        has_before = has_after = want_after = false;
+        has_last = keep;
+        if( keep )
+        {
+            last = x;
+            t_last = t;
+        }
+    }
+
+    void push( const State &x , double t , double y , bool stimulated )
+    {
+        if( keep && want_after )
+        {
+            after = x;
+            t_after = t;
+            stimulated_after = stimulated;
+            has_after = true;
+            want_after = false;
+        }
+        if( y > level )
+        {
+            level = y;
+            time = t;
+            if( keep )
+            {
+                before = last;
+                t_before = t_last;
+                has_before = has_last;
+                at = x;
+                stimulated_at = stimulated;
+                has_after = false;
+                want_after = true;
+            }
+        }
+        if( keep )
+        {
+            last = x;
+            t_last = t;
+            has_last = true;
+        }
+    }
+};
+
+
+// observer of opt.checkpoints: only the first maximum of the output
+template< class Systems >
+struct period_maximum
+{
+    typedef typename Systems::state_type state_type;
+
+    const Systems &m_s;
+    bool m_stimulated;
+    peak_samples< state_type > &m_peak;
+
+    period_maximum( const Systems &s , bool stimulated , peak_samples< state_type > &peak ) : m_s( s ) , m_stimulated( stimulated ) , m_peak( peak ) { }
+
+    void operator()( const state_type &x , double t )
+    {
+        m_peak.push( x , t , m_s.output_value( x , m_stimulated ) , m_stimulated );
+    }
+};
+
+
+// d output/dt at x from the right-hand side of the phase, as the
+// derivative of output_value along it (exact up to round-off for an
+// output that is a component of the state)
+template< class Systems >
+double output_rate( const Systems &s , const typename Systems::state_type &x , double t , bool stimulated )
+{
+    typename Systems::state_type dxdt = x , y = x;
+    if( stimulated )
+        s.on( x , dxdt , t );
+    else
+        s.off( x , dxdt , t );
+    const double h = 1E-6;
+    for( size_t i=0 ; i<x.size() ; ++i )
+        y[i] = x[i] + h*dxdt[i];
+    double up = s.output_value( y , stimulated );
+    for( size_t i=0 ; i<x.size() ; ++i )
+        y[i] = x[i] - h*dxdt[i];
+    return (up - s.output_value( y , stimulated ))/(2.0*h);
+}
+
+
+// highest maximum inside (t0, t1) of the cubic Hermite interpolant of
+// the values y and rates d at both ends; false if it has none
+inline bool hermite_maximum( double &level , double &time , double t0 , double y0 , double d0 , double t1 , double y1 , double d1 )
+{
+    double h = t1 - t0;
+    if( !(h > 0.0) )
+        return false;
+    // p(u) = y0 + a u + b u^2 + c u^3 on u = (t - t0)/h in [0, 1]
+    double a = h*d0 , b = 3.0*(y1 - y0) - h*(2.0*d0 + d1) , c = 2.0*(y0 - y1) + h*(d0 + d1);
+    double roots[2];
+    int n = 0;
+    if( abs( c ) <= 1E-14*(abs( a ) + abs( b )) )
+    {
+        if( b != 0.0 )
+            roots[n++] = -a/(2.0*b);
+    }
+    else
+    {
+        // p'(u) = a + 2 b u + 3 c u^2
+        double disc = b*b - 3.0*a*c;
+        if( disc < 0.0 )
+            return false;
+        double q = -(b + copysign( sqrt( disc ) , b ));
+        roots[n++] = q/(3.0*c);
+        if( q != 0.0 )
+            roots[n++] = a/q;
+    }
+    bool found = false;
+    for( int k=0 ; k<n ; ++k )
+    {
+        double u = roots[k];
+        if( !(u > 0.0) || !(u < 1.0) || (2.0*b + 6.0*c*u >= 0.0) )
+            continue;
+        double p = y0 + u*(a + u*(b + u*c));
+        if( !found || (p > level) )
+        {
+            level = p;
+            time = t0 + u*h;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+// ------------------------------------
+// Peak of p.level at p.time moved to the maximum of the output between
+// the samples (opt.peak_events): the output and its rate (output_rate)
+// at the samples before, at and after the maximum give a cubic Hermite
+// interpolant on each side, whose critical points are the zeros of
+// d output/dt. The highest maximum above the sample is taken, the
+// sample stays the peak otherwise (e.g. at a kink of the output where
+// the stimulus switches).
+// ------------------------------------
+template< class Systems >
+void refine_peak( peak_samples< typename Systems::state_type > &p , const Systems &s )
+{
+    double level = p.level , time = p.time , l , t;
+    if( p.has_before && hermite_maximum( l , t , p.t_before , s.output_value( p.before , p.stimulated_at ) , output_rate( s , p.before , p.t_before , p.stimulated_at ) ,
+                                         p.time , s.output_value( p.at , p.stimulated_at ) , output_rate( s , p.at , p.time , p.stimulated_at ) ) && (l > level) )
+    {
+        level = l;
+        time = t;
+    }
+    if( p.has_after && hermite_maximum( l , t , p.time , s.output_value( p.at , p.stimulated_after ) , output_rate( s , p.at , p.time , p.stimulated_after ) ,
+                                        p.t_after , s.output_value( p.after , p.stimulated_after ) , output_rate( s , p.after , p.t_after , p.stimulated_after ) ) && (l > level) )
+    {
+        level = l;
+        time = t;
+    }
+    p.level = level;
+    p.time = time;
+}
+
+
+// ------------------------------------
+// The right-hand sides and Jacobians of a model, built from the
+// parameters (p0 followed by Amax)
+// ------------------------------------
+template< class Model >
+struct model_systems
+{
+    typedef typename Model::state_type state_type;
+
+    counted_rhs< typename Model::system_on > on;
+    counted_rhs< typename Model::system_off > off;
+    counted_jacobian< typename Model::jacobian_on > jac_on;
+    counted_jacobian< typename Model::jacobian_off > jac_off;
+    size_t output;
+
+    model_systems( vector<double> &full_param ) : on( full_param ) , off( full_param ) , jac_on( full_param ) , jac_off( full_param ) , output( Model::output ) { }
+
+    // state of the model as written to the output files, stimulated
+    // tells whether x belongs to the ON or the OFF phase
+    const state_type& expand( const state_type &x , bool stimulated ) const { return x; }
+
+    double output_value( const state_type &x , bool stimulated ) const { return x[output]; }
+};
+
+
+// ------------------------------------
+// One period of the square wave (ON then OFF) from x at t, appending
+// the checkpoints, the samples (not with opt.checkpoints) and the peak
+// (between the samples with opt.peak_events) to data. Returns false if the trajectory leaves [min_level,
+// max_level] or becomes nan.
+// ------------------------------------
+template< class Systems , class Stepper >
+bool stimulation_period( habituation_data< typename Systems::state_type > &data , const Systems &s , const Stepper &stepper , typename Systems::state_type &x , double &t , int Ton_duration , int Toff_duration , const adaint_options &opt )
+{
+    count_event( period_count );
+    peak_samples< typename Systems::state_type > peak;
+    peak.start( x , t , opt.peak_events != 0 );
+    data.checkpoints.push_back( x );
+    data.checkpoint_times.push_back( t );
+    if( opt.checkpoints )
+        on_stepper( stepper ).integrate_n( s.on , s.jac_on , x , t , Ton_duration , opt.step_size , period_maximum< Systems >( s , true , peak ) );
+    else
+        on_stepper( stepper ).integrate_n( s.on , s.jac_on , x , t , Ton_duration , opt.step_size , push_back_trajectory< Systems >( data , s , true ) );
+    if ( state_out_of_bounds( s.expand( x , true ) , opt.min_level - on_stepper( stepper ).level_slack() , opt.max_level + on_stepper( stepper ).level_slack() ) )
+        return false;
+
+    data.checkpoints.push_back( x );
+    data.checkpoint_times.push_back( t );
+    if( opt.checkpoints )
+        off_stepper( stepper ).integrate_n( s.off , s.jac_off , x , t , Toff_duration , opt.step_size , period_maximum< Systems >( s , false , peak ) );
+    else
+        off_stepper( stepper ).integrate_n( s.off , s.jac_off , x , t , Toff_duration , opt.step_size , push_back_trajectory< Systems >( data , s , false ) );
+    if ( state_out_of_bounds( s.expand( x , false ) , opt.min_level - off_stepper( stepper ).level_slack() , opt.max_level + off_stepper( stepper ).level_slack() ) )
+        return false;
+
+    if( !opt.checkpoints )
+    {
+        // max element
+        size_t first = data.output_variable.size() - Ton_duration - Toff_duration;
+        size_t row = (max_element(data.output_variable.begin()+first, data.output_variable.end()) - data.output_variable.begin());
+        peak.level = data.output_variable[row];
+        peak.time = data.times[row];
+        if( opt.peak_events )
+        {
+            peak.at = data.x_vec[row];
+            peak.stimulated_at = (row - first < (size_t) Ton_duration);
+            peak.has_before = (row > 0);
+            if( peak.has_before )
+            {
+                peak.before = data.x_vec[row-1];
+                peak.t_before = data.times[row-1];
+            }
+            peak.has_after = (row+1 < data.x_vec.size());
+            if( peak.has_after )
+            {
+                peak.after = data.x_vec[row+1];
+                peak.t_after = data.times[row+1];
+                peak.stimulated_after = (row+1 - first < (size_t) Ton_duration);
+            }
+        }
+    }
+    if( opt.peak_events )
+        refine_peak( peak , s );
+    data.peaks_level.push_back(peak.level);
+    data.peaks_time.push_back(peak.time);
+    return true;
+}
+
+
+// ------------------------------------
+// Square-wave stimulation until two successive peaks differ by less
+// than int_threshold, or until the stopping rule of adaint.integrate
+// with opt.criterion = python_criterion. Returns false if the
+// trajectory leaves [min_level, max_level] or becomes nan.
+// ------------------------------------
+template< class Systems , class Stepper >
+bool habituate( habituation_data< typename Systems::state_type > &data , const Systems &s , const Stepper &stepper , double T , const typename Systems::state_type &x0 , const adaint_options &opt )
+{
+    typedef typename Systems::state_type state_type;
+
+    counted_scope timer( habituation_phase );
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+    double max_integration_time = opt.max_periods*T;
+    int python_max_periods = opt.num_periods_per_expansion << opt.max_expansion_attempts;
+    python_stopping_rule stopping_rule( opt.int_threshold , opt.min_output_level , opt.steady_counter_threshold , opt.increasing_counter_threshold );
+    sliding_maxnorm_ht sliding( opt.int_threshold );
+
+    state_type x = x0;
+    double t = 0.0;
+    push_back_trajectory< Systems > obs( data , s , false );
+    if( !opt.checkpoints )
+        obs( x , t );
+    data.ht = 0;
+    data.sliding_ht = 0;
+
+    while ((opt.criterion == python_criterion) ? (data.ht < python_max_periods) : (t <= max_integration_time))
+    {
+        data.ht+=1;
+        if( !stimulation_period( data , s , stepper , x , t , Ton_duration , Toff_duration , opt ) )
+            return false;
+        sliding.push( data.peaks_level.back() );
+        data.sliding_ht = sliding.ht();
+
+        if( opt.criterion == python_criterion )
+        {
+            if( stopping_rule.push( data.peaks_level.back() ) )
+                break;
+            continue;
+        }
+        int nro_picos = data.peaks_time.size();
+        if (nro_picos >= 2)
+        {
+            if(abs(1 - data.peaks_level[nro_picos-1]/data.peaks_level[nro_picos-2])<opt.int_threshold)
+            {
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+
+// ------------------------------------
+// Habituation time (number of periods, 60.0 if rejected) for any
+// model providing the description of ../*/system.h. With the python
+// criterion it is sliding_maxnorm_ht (0 if not habituated).
+// ------------------------------------
+template< class Systems , class Stepper >
+double adaint_systems( const Systems &s , const Stepper &stepper , double T , const typename Systems::state_type &x0 , const adaint_options &opt )
+{
+    counted_scope call( adaint_call );
+    habituation_data< typename Systems::state_type > data;
+    if( !habituate( data , s , stepper , T , x0 , opt ) )
+    {
+        count_event( rejection_count );
+        return 60.0;
+    }
+    if( opt.criterion == python_criterion )
+        return (double)data.sliding_ht;
+    return (double)data.ht;
+}
+
+
+template< class Model >
+double adaint( double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt = adaint_options() )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > s( full_param );
+
+    if( phase_methods( opt ) )
+        return adaint_systems( s , configured_policy< Model >( opt ) , T , x0 , opt );
+    if( use_stiff_stepper< Model >( opt ) )
+        return adaint_systems( s , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , T , x0 , opt );
+    return adaint_systems( s , explicit_stepper( opt.abs_tol , opt.rel_tol ) , T , x0 , opt );
+}
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <map>
+
+#include<boost/array.hpp>
+#include <boost/numeric/odeint.hpp>
+#include "adaint.h"
+#include "trajectory_sink.h"
+#include "replay.h"
+#include "parareal.h"
+
+
+using namespace std;
+using namespace boost::numeric::odeint;
+
+
+template< class State >
+struct push_back_state_and_time
+{
+    std::vector< State >& m_states;
+    std::vector< double >& m_times;
+
+    push_back_state_and_time( std::vector< State > &states , std::vector< double > &times )
+    : m_states( states ) , m_times( times ) { }
+
+    void operator()( const State &x_recov , double t )
+    {
+        m_states.push_back( x_recov );
+        m_times.push_back( t );
+    }
+};
+
+
+// Time followed by the full state of the samples of data: sample 0 is
+// the initial state, then every period has Ton_duration samples of the
+// ON phase followed by Toff_duration samples of the OFF phase. The
+// format follows the file name (trajectory_sink.h): .npy binary, .gz
+// compressed, text otherwise (one line per sample). opt.print_every
+// and opt.print_periods decimate the samples.
+template< class Systems >
+bool write_trajectory( const char* fnm , const Systems &s , const habituation_data< typename Systems::state_type > &data , int Ton_duration , int Toff_duration , const adaint_options &opt = adaint_options() )
+{
+    int period = Ton_duration+Toff_duration;
+    vector< size_t > rows;
+    if( opt.print_periods )
+    {
+        rows.push_back( 0 );
+        for( size_t start=1 ; start+period<=data.times.size() ; start+=period )
+        {
+            size_t peak = max_element( data.output_variable.begin()+start , data.output_variable.begin()+start+period ) - data.output_variable.begin();
+            if( peak != start+period-1 )
+                rows.push_back( peak );
+            rows.push_back( start+period-1 );
+        }
+    }
+    else
+    {
+        for( size_t i=0 ; i<data.times.size() ; i+=max( 1 , opt.print_every ) )
+            rows.push_back( i );
+    }
+
+    size_t dim = data.x_vec.empty() ? 0 : s.expand( data.x_vec[0] , false ).size();
+    unique_ptr< trajectory_sink > sink = make_trajectory_sink( fnm );
+    if( !sink->open( fnm , rows.size() , dim+1 ) )
+        return false;
+    vector< double > row( dim+1 );
+    for( size_t k=0 ; k<rows.size() ; ++k )
+    {
+        size_t i = rows[k];
+        row[0] = data.times[i];
+        bool stimulated = (i > 0) && ((i-1) % period < (size_t) Ton_duration);
+        const auto &x = s.expand( data.x_vec[i] , stimulated );
+        std::copy( x.begin() , x.end() , row.begin()+1 );
+        sink->write( row.data() );
+    }
+    return sink->close();
+}
+
+
+// write_trajectory of a run kept as checkpoints or in full
+template< class Systems , class Stepper >
+bool write_habituation( const char* fnm , const Systems &s , const Stepper &stepper , const habituation_data< typename Systems::state_type > &data , double T , const adaint_options &opt )
+{
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+    if( !data.x_vec.empty() )
+        return write_trajectory( fnm , s , data , Ton_duration , Toff_duration , opt );
+    habituation_data< typename Systems::state_type > window;
+    replay_window( window , data , s , stepper , T , -numeric_limits< double >::infinity() , numeric_limits< double >::infinity() , opt );
+    return write_trajectory( fnm , s , window , Ton_duration , Toff_duration , opt );
+}
+
+// Time followed by the full state of an unstimulated trajectory (the
+// recovery relaxation), in the format of write_trajectory
+template< class Systems >
+bool write_states( const string &fnm , const Systems &s , const vector< double > &times , const vector< typename Systems::state_type > &states )
+{
+    size_t dim = states.empty() ? 0 : s.expand( states[0] , false ).size();
+    unique_ptr< trajectory_sink > sink = make_trajectory_sink( fnm );
+    if( !sink->open( fnm , states.size() , dim+1 ) )
+        return false;
+    vector< double > row( dim+1 );
+    for( size_t i=0 ; i<states.size() ; ++i )
+    {
+        row[0] = times[i];
+        const auto &x = s.expand( states[i] , false );
+        std::copy( x.begin() , x.end() , row.begin()+1 );
+        sink->write( row.data() );
+    }
+    return sink->close();
+}
+
+
+// ------------------------------------
+// Peak of the output over one period (ON then OFF) starting from x,
+// between the samples with opt.peak_events. Returns false if the state leaves [min_level, max_level].
+// ------------------------------------
+template< class Systems , class Stepper >
+bool period_peak( double &peak , const Systems &s , const Stepper &stepper , typename Systems::state_type x , double T , const adaint_options &opt )
+{
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+
+    double t = 0.0;
+    peak_samples< typename Systems::state_type > p;
+    p.start( x , t , opt.peak_events != 0 );
+    on_stepper( stepper ).integrate_n( s.on , s.jac_on , x , t , Ton_duration , opt.step_size , period_maximum< Systems >( s , true , p ) );
+    if ( state_out_of_bounds( s.expand( x , true ) , opt.min_level - on_stepper( stepper ).level_slack() , opt.max_level + on_stepper( stepper ).level_slack() ) )
+        return false;
+
+    off_stepper( stepper ).integrate_n( s.off , s.jac_off , x , t , Toff_duration , opt.step_size , period_maximum< Systems >( s , false , p ) );
+    if ( state_out_of_bounds( s.expand( x , false ) , opt.min_level - off_stepper( stepper ).level_slack() , opt.max_level + off_stepper( stepper ).level_slack() ) )
+        return false;
+
+    if( opt.peak_events )
+        refine_peak( p , s );
+    peak = p.level;
+    return true;
+}
+
+
+// sample the recovery relaxes from after a habituation of n_samples:
+// the end of the last but one period, or the habituation_time_step of
+// system.py with the python criterion
+inline size_t recovery_start( size_t n_samples , int sliding_ht , double T , const adaint_options &opt )
+{
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+
+    size_t last = n_samples-Ton_duration-Toff_duration-2;
+    if( opt.criterion == python_criterion )
+        last = min( last , (size_t) max( 0 , int(sliding_ht*T/opt.step_size) - 1 ) );
+    return last;
+}
+
+
+// ------------------------------------
+// Test-period peaks after relaxing without stimulus from x for up to
+// T*2^recovery_depth, sampled every step_size_big. The peaks are
+// computed on demand and kept, so that several recovery thresholds
+// share the test periods.
+// ------------------------------------
+template< class Systems , class Stepper >
+struct recovery_response
+{
+    typedef typename Systems::state_type state_type;
+
+    const Systems &m_s;
+    const Stepper &m_stepper;
+    double m_T;
+    adaint_options m_opt;
+    vector<state_type> m_x_vec_recov;
+    vector<double> m_times_rec;
+    map< int , double > m_peaks;
+
+    recovery_response( const Systems &s , const Stepper &stepper , double T , state_type x_recov , double t , const adaint_options &opt )
+    : m_s( s ) , m_stepper( stepper ) , m_T( T ) , m_opt( opt )
+    {
+        relax( x_recov , t );
+    }
+
+    // relaxation from recovery_start of a habituation
+    recovery_response( const Systems &s , const Stepper &stepper , double T , const habituation_data< state_type > &data , const adaint_options &opt )
+    : m_s( s ) , m_stepper( stepper ) , m_T( T ) , m_opt( opt )
+    {
+        state_type x_recov;
+        double t;
+        habituation_sample( x_recov , t , data , s , stepper , recovery_start( habituation_samples( data , T , opt ) , data.sliding_ht , T , opt ) , T , opt );
+        relax( x_recov , t );
+    }
+
+    void relax( state_type x_recov , double t )
+    {
+        double tmax= m_T*pow(2,m_opt.recovery_depth) + t;
+        if( m_opt.recovery_slices > 1 )
+            parareal_integrate_const( m_x_vec_recov , m_times_rec , m_s.off , m_s.jac_off , relax_stepper( m_stepper ) , x_recov , t , tmax , m_opt.step_size_big , m_opt.recovery_slices , m_opt.parareal_tol );
+        else
+            relax_stepper( m_stepper ).integrate_const( m_s.off , m_s.jac_off , x_recov , t , tmax , m_opt.step_size_big , push_back_state_and_time< state_type >( m_x_vec_recov , m_times_rec ) );
+    }
+
+    int size() const { return m_x_vec_recov.size(); }
+
+    // peak of the test period after i+1 samples of relaxation
+    bool peak( double &p , int i )
+    {
+        typename map< int , double >::const_iterator it = m_peaks.find( i );
+        if( it != m_peaks.end() )
+        {
+            p = it->second;
+            return true;
+        }
+        count_event( probe_count );
+        if( !period_peak( p , m_s , probe_stepper( m_stepper ) , m_x_vec_recov[i] , m_T , m_opt ) )
+            return false;
+        m_peaks[i] = p;
+        return true;
+    }
+
+    // bisection on the time at which the test peak exceeds
+    // threshold*first_peak, the response is assumed monotone (the
+    // whole relaxation, size()*step_size_big, if it never does)
+    bool time( double &rt , double threshold , double first_peak )
+    {
+        int dt = size();
+        int resul_t = 0;
+        while (dt > 0)
+        {
+            double p;
+            if( !peak( p , resul_t+dt-1 ) )
+                return false;
+
+            double post_recovery_peak = p/first_peak;
+            if (post_recovery_peak<threshold)
+            {
+                resul_t = resul_t + dt;
+                // not recovered at the end of the relaxation
+                if( resul_t == size() )
+                    break;
+            }
+            dt = (int)(dt / 2);
+        }
+
+        rt = resul_t*m_opt.step_size_big;
+        return true;
+    }
+};
+
+
+// ------------------------------------
+// Recovery time after habituation: relax without stimulus for
+// T*2^recovery_depth and bisect on the time at which a test period
+// gives a peak above recovery_threshold*first peak. Returns false if a
+// test period leaves [min_level, max_level]. The relaxation is written
+// to fnm if given.
+// ------------------------------------
+template< class Systems , class Stepper >
+bool recovery_time( double &rt , const Systems &s , const Stepper &stepper , double T , const habituation_data< typename Systems::state_type > &data , const adaint_options &opt , const char* fnm = 0 )
+{
+    recovery_response< Systems , Stepper > response( s , stepper , T , data , opt );
+    if( fnm )
+        write_states( fnm , s , response.m_times_rec , response.m_x_vec_recov );
+    return response.time( rt , opt.recovery_threshold , data.peaks_level[0] );
+}
+
+
+// ------------------------------------
+// Habituation time (periods - 1) and recovery time in result[0] and
+// result[1], as in sensitivity_*/adaint_recovery.h. With the python
+// criterion result[0] is sliding_maxnorm_ht and the recovery is only
+// computed for habituated runs (ht > 0), as in system.py.
+// ------------------------------------
+template< class Systems , class Stepper >
+double adaint_recovery_systems( const Systems &s , const Stepper &stepper , habituation_data< typename Systems::state_type > &data , vector<double> &result , double T , const typename Systems::state_type &x0 , const adaint_options &opt , int print , const char* fnm , int recovery_true )
+{
+    counted_scope call( adaint_recovery_call );
+    if( !habituate( data , s , stepper , T , x0 , opt ) )
+    {
+        count_event( rejection_count );
+        return 60.0;
+    }
+    int ht = (opt.criterion == python_criterion) ? data.sliding_ht + 1 : data.ht;
+
+    result[0] = ht - 1;
+    if (print)
+        write_habituation( fnm , s , stepper , data , T , opt );
+
+    bool habituated = (opt.criterion == python_criterion) ? (result[0] > 0) : (result[0] < 50);
+    if ((recovery_true) && habituated)
+    {
+        // named only when it is written: fnm may be 0 without print
+        string fnm_recovery;
+        if( print && opt.print_recovery )
+            fnm_recovery = recovery_file_name( fnm );
+        counted_scope timer( recovery_phase );
+        if( !recovery_time( result[1] , s , stepper , T , data , opt , fnm_recovery.empty() ? 0 : fnm_recovery.c_str() ) )
+        {
+            count_event( rejection_count );
+            return 60.0;
+        }
+    }
+    else
+    {
+        result[1] = -1;
+    }
+    return (double)(ht-1);
+}
+
+
+template< class Systems , class Stepper >
+double adaint_recovery_systems( const Systems &s , const Stepper &stepper , vector<double> &result , double T , const typename Systems::state_type &x0 , const adaint_options &opt , int print , const char* fnm , int recovery_true )
+{
+    habituation_data< typename Systems::state_type > data;
+    return adaint_recovery_systems( s , stepper , data , result , T , x0 , opt , print , fnm , recovery_true );
+}
+
+
+// adaint_recovery keeping the habituation trajectory and peaks in data
+template< class Model >
+double adaint_recovery_trajectory( habituation_data< typename Model::state_type > &data , vector<double> &result , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt , int recovery_true )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > s( full_param );
+
+    if( phase_methods( opt ) )
+        return adaint_recovery_systems( s , configured_policy< Model >( opt ) , data , result , T , x0 , opt , 0 , "" , recovery_true );
+    if( use_stiff_stepper< Model >( opt ) )
+        return adaint_recovery_systems( s , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , data , result , T , x0 , opt , 0 , "" , recovery_true );
+    return adaint_recovery_systems( s , explicit_stepper( opt.abs_tol , opt.rel_tol ) , data , result , T , x0 , opt , 0 , "" , recovery_true );
+}
+
+
+template< class Model >
+double adaint_recovery( vector<double> &result , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt , int print , const char* fnm , int recovery_true )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > s( full_param );
+
+    if( phase_methods( opt ) )
+        return adaint_recovery_systems( s , configured_policy< Model >( opt ) , result , T , x0 , opt , print , fnm , recovery_true );
+    if( use_stiff_stepper< Model >( opt ) )
+        return adaint_recovery_systems( s , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , result , T , x0 , opt , print , fnm , recovery_true );
+    return adaint_recovery_systems( s , explicit_stepper( opt.abs_tol , opt.rel_tol ) , result , T , x0 , opt , print , fnm , recovery_true );
+}
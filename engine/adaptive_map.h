@@ -0,0 +1,215 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "sweep.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Adaptive (T, Amax) map of one parameter set: a coarse grid whose
+// cells are split in four, recursively, where their corners disagree.
+// Points live on the finest grid of levels halvings of the coarse
+// cells (index (i, j), step 2^levels per coarse cell), the values in
+// between coarse grid points are linear in T and Amax.
+// ------------------------------------
+struct map_point
+{
+    size_t i;                   // index on the finest grid
+    size_t j;
+    double T;
+    double Amax;
+    double ht;
+    double rt;
+};
+
+
+struct map_cell
+{
+    size_t i;                   // lower corner on the finest grid
+    size_t j;
+    size_t size;                // edge in finest grid steps
+};
+
+
+struct adaptive_map
+{
+    size_t levels;
+    size_t n_T;                 // points of the finest grid
+    size_t n_Amax;
+    vector< map_point > points; // every run, in the order of evaluation
+    vector< map_cell > cells;   // leaves, the multi-resolution map
+    map< pair< size_t , size_t > , size_t > index;
+
+    const map_point& at( size_t i , size_t j ) const { return points[index.find( make_pair( i , j ) )->second]; }
+
+    // the finest grid (n_T x n_Amax, Amax fastest) filled from the
+    // lower-left corner of the leaf holding each point
+    void rasterize( vector<double> &ht , vector<double> &rt ) const
+    {
+        ht.assign( n_T*n_Amax , 0.0 );
+        rt.assign( n_T*n_Amax , 0.0 );
+        for( size_t c=0 ; c<cells.size() ; ++c )
+        {
+            const map_cell &cell = cells[c];
+            for( size_t i=cell.i ; (i<=cell.i+cell.size) && (i<n_T) ; ++i )
+                for( size_t j=cell.j ; (j<=cell.j+cell.size) && (j<n_Amax) ; ++j )
+                {
+                    map< pair< size_t , size_t > , size_t >::const_iterator it = index.find( make_pair( i , j ) );
+                    const map_point &p = (it != index.end()) ? points[it->second] : at( cell.i , cell.j );
+                    ht[i*n_Amax + j] = p.ht;
+                    rt[i*n_Amax + j] = p.rt;
+                }
+        }
+    }
+};
+
+
+// rejected (60), not habituated (no recovery time) or habituated
+inline int map_feasibility( const map_point &p )
+{
+    if( p.ht == 60.0 )
+        return 0;
+    return (p.rt < 0.0) ? 1 : 2;
+}
+
+
+// value at index k of the finest grid refining coarse by 2^levels
+inline double refined_value( const vector<double> &coarse , size_t levels , size_t k )
+{
+    size_t step = size_t( 1 ) << levels;
+    size_t c = min( k / step , coarse.size()-1 );
+    if( c == coarse.size()-1 )
+        return coarse[c];
+    return coarse[c] + (coarse[c+1] - coarse[c])*double( k - c*step )/double( step );
+}
+
+
+// ------------------------------------
+// Refines the coarse grid.T x grid.Amax cells up to levels times: a cell
+// is split while its corners differ in map_feasibility, their ht by
+// more than ht_tolerance (any change with 0) or their rt by more than
+// rt_tolerance (relative to the largest).
+// Every level is evaluated as one batch on the parallel_for pool with
+// run (as in adaint_recovery_sweep). Points written to fnm, if given,
+// as sweep rows (set 0, finest grid indices, T, Amax, ton, ht, rt).
+// ------------------------------------
+template< class Run >
+bool adaint_recovery_adaptive_map( adaptive_map &m , const sweep_grid &grid , const vector<double> &p0 , const vector<double> &x0 , Run run ,
+                                   const adaint_options &opt , size_t levels , double ht_tolerance = 0.0 , double rt_tolerance = 0.05 , const char *fnm = 0 , unsigned n_threads = 0 )
+{
+    size_t step = size_t( 1 ) << levels;
+    m.levels = levels;
+    m.n_T = (grid.T.size()-1)*step + 1;
+    m.n_Amax = (grid.Amax.size()-1)*step + 1;
+    m.points.clear();
+    m.cells.clear();
+    m.index.clear();
+
+    vector< pair< size_t , size_t > > pending;
+    auto request = [&]( size_t i , size_t j ) {
+        if( m.index.insert( make_pair( make_pair( i , j ) , m.points.size() ) ).second )
+        {
+            map_point p = { i , j , refined_value( grid.T , levels , i ) , refined_value( grid.Amax , levels , j ) , 60.0 , -1.0 };
+            m.points.push_back( p );
+            pending.push_back( make_pair( i , j ) );
+        }
+    };
+    auto evaluate = [&]() {
+        size_t first = m.points.size() - pending.size();
+        parallel_for( pending.size() , [&]( size_t q ) {
+            map_point &p = m.points[first + q];
+            vector<double> result( 2 , -1.0 );
+            p.ht = run( result , p.T , p.Amax , p0 , x0 , opt );
+            p.rt = result[1];
+        } , n_threads );
+        pending.clear();
+    };
+    auto disagree = [&]( const map_cell &c ) {
+        const map_point *corner[4] = { &m.at( c.i , c.j ) , &m.at( c.i+c.size , c.j ) , &m.at( c.i , c.j+c.size ) , &m.at( c.i+c.size , c.j+c.size ) };
+        double rt_max = 0.0;
+        for( int k=0 ; k<4 ; ++k )
+            rt_max = max( rt_max , abs( corner[k]->rt ) );
+        for( int k=1 ; k<4 ; ++k )
+        {
+            if( map_feasibility( *corner[k] ) != map_feasibility( *corner[0] ) )
+                return true;
+            if( abs( corner[k]->ht - corner[0]->ht ) > ht_tolerance )
+                return true;
+            if( abs( corner[k]->rt - corner[0]->rt ) > rt_tolerance*rt_max )
+                return true;
+        }
+        return false;
+    };
+
+    vector< map_cell > active;
+    for( size_t a=0 ; a<grid.T.size() ; ++a )
+        for( size_t b=0 ; b<grid.Amax.size() ; ++b )
+        {
+            request( a*step , b*step );
+            if( (a+1 < grid.T.size()) && (b+1 < grid.Amax.size()) )
+            {
+                map_cell c = { a*step , b*step , step };
+                active.push_back( c );
+            }
+        }
+    evaluate();
+
+    while( !active.empty() )
+    {
+        vector< map_cell > split;
+        for( size_t c=0 ; c<active.size() ; ++c )
+        {
+            if( (active[c].size > 1) && disagree( active[c] ) )
+                split.push_back( active[c] );
+            else
+                m.cells.push_back( active[c] );
+        }
+        active.clear();
+        for( size_t c=0 ; c<split.size() ; ++c )
+        {
+            size_t h = split[c].size/2 , i = split[c].i , j = split[c].j;
+            request( i+h , j );
+            request( i , j+h );
+            request( i+h , j+h );
+            request( i+2*h , j+h );
+            request( i+h , j+2*h );
+            for( int k=0 ; k<4 ; ++k )
+            {
+                map_cell child = { i + (k/2)*h , j + (k%2)*h , h };
+                active.push_back( child );
+            }
+        }
+        evaluate();
+    }
+
+    if( !fnm )
+        return true;
+    unique_ptr< trajectory_sink > sink = make_trajectory_sink( fnm );
+    if( !sink->open( fnm , m.points.size() , sweep_columns ) )
+        return false;
+    for( size_t k=0 ; k<m.points.size() ; ++k )
+    {
+        const map_point &p = m.points[k];
+        double row[sweep_columns] = { 0.0 , double( p.i ) , double( p.j ) , 0.0 , p.T , p.Amax , opt.ton , p.ht , p.rt };
+        sink->write( row );
+    }
+    return sink->close();
+}
+
+
+template< class Model >
+bool adaint_recovery_adaptive_map( adaptive_map &m , const sweep_grid &grid , const vector<double> &p0 , const typename Model::state_type &x0 ,
+                                   const adaint_options &opt , int recovery_true , size_t levels , double ht_tolerance = 0.0 , double rt_tolerance = 0.05 , const char *fnm = 0 , unsigned n_threads = 0 )
+{
+    vector<double> x( x0.begin() , x0.end() );
+    return adaint_recovery_adaptive_map( m , grid , p0 , x ,
+        [&]( vector<double> &result , double T , double Amax , const vector<double> &p , const vector<double> &xv , const adaint_options &o ) {
+            typename Model::state_type s;
+            std::copy( xv.begin() , xv.end() , s.begin() );
+            return adaint_recovery< Model >( result , T , Amax , p , s , o , 0 , "" , recovery_true );
+        } , opt , levels , ht_tolerance , rt_tolerance , fnm , n_threads );
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "adaint_recovery.h"
+#include "parallel_for.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Protocol of run i of a batch: parameter set params[i*n_params ...],
+// period T[i], amplitude Amax[i], ton[i] and initial state
+// x0[i*x0_stride ...] (x0_stride = 0 shares one x0).
+// ------------------------------------
+struct batch_input
+{
+    size_t n;
+    size_t n_params;
+    const double *params;
+    const double *T;
+    const double *Amax;
+    const double *ton;
+    const double *x0;
+    size_t x0_stride;
+};
+
+
+// adaint_recovery of every run of the batch into ht[i] and rt[i]. run
+// is called as run(result, T, Amax, p0, x0, opt) and returns ht, e.g.
+// a runtime_model or adaint_recovery<Model> wrapped in a lambda.
+template< class Run >
+void adaint_recovery_batch( const batch_input &in , size_t dim , Run run , const adaint_options &opt , double *ht , double *rt , unsigned n_threads = 0 )
+{
+    parallel_for( in.n , [&]( size_t i ) {
+        adaint_options o = opt;
+        o.ton = in.ton[i];
+        vector<double> p0( in.params + i*in.n_params , in.params + (i+1)*in.n_params );
+        vector<double> x0( in.x0 + i*in.x0_stride , in.x0 + i*in.x0_stride + dim );
+        vector<double> result( 2 , -1.0 );
+        ht[i] = run( result , in.T[i] , in.Amax[i] , p0 , x0 , o );
+        rt[i] = result[1];
+    } , n_threads );
+}
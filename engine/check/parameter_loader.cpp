@@ -0,0 +1,93 @@
+// Checks of ../parameter_loader.h on the fixture files of this
+// directory: the tables read and the lines written to cerr on malformed
+// files. Run with make (prints the failed checks, exits with 1 if any).
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../parameter_loader.h"
+
+
+using namespace std;
+
+
+int failures = 0;
+
+void check( bool ok , const string &what )
+{
+    if( !ok )
+    {
+        cout << "FAILED: " << what << endl;
+        ++failures;
+    }
+}
+
+
+// calls f with cerr redirected, returns what was written to it
+template< class F >
+string captured_cerr( F f )
+{
+    ostringstream err;
+    streambuf *old = cerr.rdbuf( err.rdbuf() );
+    f();
+    cerr.rdbuf( old );
+    return err.str();
+}
+
+
+bool same_values( const parameter_table &t , const vector< double > &values )
+{
+    return t.values == values;
+}
+
+
+int main()
+{
+    parameter_table t;
+    bool ok;
+    string err;
+
+    // the header names the columns
+    err = captured_cerr( [&]{ ok = load_parameters( t , "header.csv" , 3 ); } );
+    check( ok && err.empty() , "header.csv: read" );
+    check( t.names == vector< string >( { "b" , "a" , "c" } ) , "header.csv: header detected" );
+    check( (t.rows() == 2) && same_values( t , { 2 , 1 , 3 , 5 , 4 , 6e-3 } ) , "header.csv: values, +5 and CRLF" );
+
+    // columns picked by name
+    err = captured_cerr( [&]{ ok = load_parameters( t , "header.csv" , 0 , { "a" , "c" } ); } );
+    check( ok && err.empty() , "header.csv by name: read" );
+    check( (t.n_columns == 2) && (t.names == vector< string >( { "a" , "c" } )) , "header.csv by name: columns" );
+    check( same_values( t , { 1 , 3 , 4 , 6e-3 } ) , "header.csv by name: values" );
+
+    err = captured_cerr( [&]{ ok = load_parameters( t , "header.csv" , 0 , { "a" , "z" } ); } );
+    check( !ok && (err == "load_parameters: header.csv: no column z\n") , "header.csv by name: missing column" );
+
+    // wrong column count
+    err = captured_cerr( [&]{ ok = load_parameters( t , "header.csv" , 4 ); } );
+    check( !ok && (err == "load_parameters: header.csv:2: header has 3 columns, expected 4\n") , "header.csv: wrong column count" );
+
+    err = captured_cerr( [&]{ ok = load_parameters( t , "short_row.txt" , 3 ); } );
+    check( !ok && (err == "load_parameters: short_row.txt:2: 2 values, expected 3\n") , "short_row.txt: short row" );
+
+    err = captured_cerr( [&]{ ok = load_parameters( t , "not_a_number.txt" , 3 ); } );
+    check( !ok && (err == "load_parameters: not_a_number.txt:2: not a number: x\n") , "not_a_number.txt: not a number" );
+
+    err = captured_cerr( [&]{ ok = load_parameters( t , "missing.txt" , 3 ); } );
+    check( !ok && (err == "mapped_file: cannot read missing.txt\n") , "missing.txt: no file" );
+
+    // ESEA population, INVALID fitness
+    vector< double > fitness;
+    err = captured_cerr( [&]{ ok = load_esea_population( t , "population.txt" , 3 , &fitness ); } );
+    check( ok && err.empty() , "population.txt: read" );
+    check( (t.rows() == 2) && same_values( t , { 1 , 2 , 3 , 4 , 5 , 6 } ) , "population.txt: genes" );
+    check( (fitness.size() == 2) && (fitness[0] == 0.5) && std::isnan( fitness[1] ) , "population.txt: fitness, nan for INVALID" );
+
+    err = captured_cerr( [&]{ ok = load_esea_population( t , "population.txt" , 4 ); } );
+    check( !ok && (err == "load_esea_population: population.txt:3: expected fitness 4 followed by 4 genes\n") , "population.txt: wrong gene count" );
+
+    cout << (failures ? "parameter_loader: " + to_string( failures ) + " checks failed" : "parameter_loader: all checks passed") << endl;
+    return failures ? 1 : 0;
+}
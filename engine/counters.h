@@ -0,0 +1,371 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Performance counters. Off unless the environment variable
+// HABITUATION_COUNTERS names a file (%p in it becomes the process id)
+// or enable_counters is called; then every thread counts into its own
+// block and at exit the blocks are written to that file as JSON:
+// totals of the counters, calls, time and a latency histogram of
+// every timer, and one record per call (adaint, adaint_recovery,
+// real_value, sensitivity) with the counters and phase times spent in
+// it, nested calls included. Disabled, a hook costs a test of a flag.
+// ------------------------------------
+enum counter_id { rhs_count = 0 , jacobian_count , period_count , probe_count , rejection_count , n_counters };
+
+// the _call timers keep a record of every call, the _phase ones only
+// totals and histograms
+enum timer_id { adaint_call = 0 , adaint_recovery_call , real_value_call , sensitivity_call , habituation_phase , recovery_phase , n_timers };
+enum { n_call_timers = habituation_phase };
+
+const size_t counter_histogram_buckets = 40;   // bucket k: below 2^k microseconds
+const size_t max_call_records = 1 << 20;       // per thread, later calls only count in the totals
+
+
+inline const char* counter_name( int c )
+{
+    static const char* names[n_counters] = { "rhs_evaluations" , "jacobian_evaluations" , "periods" , "recovery_probes" , "early_rejections" };
+    return names[c];
+}
+
+inline const char* timer_name( int k )
+{
+    static const char* names[n_timers] = { "adaint" , "adaint_recovery" , "real_value" , "sensitivity" , "habituation" , "recovery" };
+    return names[k];
+}
+
+
+struct call_record
+{
+    int timer;
+    double start;               // seconds since the counters were enabled
+    double seconds;
+    uint64_t counts[n_counters];
+    double phase_seconds[n_timers - n_call_timers];
+};
+
+
+// counters of one thread, written only by it (relaxed load and store,
+// no locked instruction) and read by write_counters
+struct counter_block
+{
+    atomic< uint64_t > counts[n_counters];
+    atomic< uint64_t > calls[n_timers];
+    atomic< uint64_t > nanoseconds[n_timers];
+    atomic< uint64_t > histogram[n_timers][counter_histogram_buckets];
+    mutex records_mutex;
+    vector< call_record > records;
+    uint64_t dropped_records;
+
+    counter_block() : dropped_records( 0 )
+    {
+        for( int c=0 ; c<n_counters ; ++c )
+            counts[c].store( 0 );
+        for( int k=0 ; k<n_timers ; ++k )
+        {
+            calls[k].store( 0 );
+            nanoseconds[k].store( 0 );
+            for( size_t b=0 ; b<counter_histogram_buckets ; ++b )
+                histogram[k][b].store( 0 );
+        }
+    }
+};
+
+
+inline void bump( atomic< uint64_t > &c , uint64_t n )
+{
+    c.store( c.load( memory_order_relaxed ) + n , memory_order_relaxed );
+}
+
+
+inline void write_counters_at_exit();
+
+// never destroyed, so that the blocks outlive their threads and the
+// handler of atexit. A thread that ends puts its block on free_blocks,
+// where the next thread that counts picks it up: the threads that
+// parallel_for starts on every call do not add blocks, and blocks
+// holds as many as the most threads that counted at once.
+struct counter_registry
+{
+    mutex m;
+    vector< counter_block* > blocks;
+    vector< counter_block* > free_blocks;
+    string file;
+    atomic< bool > enabled;
+    bool exit_handler;
+    chrono::steady_clock::time_point start;
+
+    counter_registry() : enabled( false ) , exit_handler( false ) , start( chrono::steady_clock::now() )
+    {
+        const char *fnm = getenv( "HABITUATION_COUNTERS" );
+        if( fnm && *fnm )
+            enable( fnm );
+    }
+
+    void enable( const string &fnm )
+    {
+        file = fnm;
+        size_t pid = file.find( "%p" );
+        if( pid != string::npos )
+            file.replace( pid , 2 , to_string( getpid() ) );
+        start = chrono::steady_clock::now();
+        enabled = true;
+        if( !exit_handler )
+            exit_handler = (atexit( write_counters_at_exit ) == 0);
+    }
+};
+
+
+inline counter_registry& counter_state()
+{
+    static counter_registry *r = new counter_registry();
+    return *r;
+}
+
+inline bool counters_enabled()
+{
+    return counter_state().enabled.load( memory_order_relaxed );
+}
+
+// start counting, written to fnm at exit (disable_counters stops)
+inline void enable_counters( const string &fnm )
+{
+    lock_guard< mutex > lock( counter_state().m );
+    counter_state().enable( fnm );
+}
+
+inline void disable_counters()
+{
+    counter_state().enabled = false;
+}
+
+// the block of a thread, given back to the registry when the thread ends
+struct counter_block_owner
+{
+    counter_block *block;
+
+    counter_block_owner() : block( 0 ) { }
+
+    ~counter_block_owner()
+    {
+        if( !block )
+            return;
+        lock_guard< mutex > lock( counter_state().m );
+        counter_state().free_blocks.push_back( block );
+    }
+};
+
+inline counter_block& thread_counters()
+{
+    static thread_local counter_block_owner owner;
+    if( !owner.block )
+    {
+        counter_registry &r = counter_state();
+        lock_guard< mutex > lock( r.m );
+        if( r.free_blocks.empty() )
+        {
+            owner.block = new counter_block();
+            r.blocks.push_back( owner.block );
+        }
+        else
+        {
+            owner.block = r.free_blocks.back();
+            r.free_blocks.pop_back();
+        }
+    }
+    return *owner.block;
+}
+
+
+inline void count_event( counter_id c , uint64_t n = 1 )
+{
+    if( counters_enabled() )
+        bump( thread_counters().counts[c] , n );
+}
+
+
+// ------------------------------------
+// Times a scope (or up to stop) into timer k. For a _call timer the
+// counters and phase times spent in the scope are kept as a record.
+// ------------------------------------
+class counted_scope
+{
+    int m_timer;
+    counter_block *m_block;
+    chrono::steady_clock::time_point m_start;
+    uint64_t m_counts[n_counters];
+    uint64_t m_phase_nanoseconds[n_timers - n_call_timers];
+
+public:
+    counted_scope( timer_id k ) : m_timer( k ) , m_block( 0 )
+    {
+        if( !counters_enabled() )
+            return;
+        m_block = &thread_counters();
+        if( m_timer < n_call_timers )
+        {
+            for( int c=0 ; c<n_counters ; ++c )
+                m_counts[c] = m_block->counts[c].load( memory_order_relaxed );
+            for( int k=n_call_timers ; k<n_timers ; ++k )
+                m_phase_nanoseconds[k-n_call_timers] = m_block->nanoseconds[k].load( memory_order_relaxed );
+        }
+        m_start = chrono::steady_clock::now();
+    }
+
+    ~counted_scope() { stop(); }
+
+    void stop()
+    {
+        if( !m_block )
+            return;
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        uint64_t ns = chrono::duration_cast< chrono::nanoseconds >( end - m_start ).count();
+        size_t bucket = 0;
+        for( uint64_t us = ns/1000 ; (us > 0) && (bucket+1 < counter_histogram_buckets) ; us >>= 1 )
+            ++bucket;
+        bump( m_block->calls[m_timer] , 1 );
+        bump( m_block->nanoseconds[m_timer] , ns );
+        bump( m_block->histogram[m_timer][bucket] , 1 );
+
+        if( m_timer < n_call_timers )
+        {
+            call_record r;
+            r.timer = m_timer;
+            r.start = chrono::duration< double >( m_start - counter_state().start ).count();
+            r.seconds = 1E-9*ns;
+            for( int c=0 ; c<n_counters ; ++c )
+                r.counts[c] = m_block->counts[c].load( memory_order_relaxed ) - m_counts[c];
+            for( int k=n_call_timers ; k<n_timers ; ++k )
+                r.phase_seconds[k-n_call_timers] = 1E-9*(m_block->nanoseconds[k].load( memory_order_relaxed ) - m_phase_nanoseconds[k-n_call_timers]);
+            lock_guard< mutex > lock( m_block->records_mutex );
+            if( m_block->records.size() < max_call_records )
+                m_block->records.push_back( r );
+            else
+                ++m_block->dropped_records;
+        }
+        m_block = 0;
+    }
+};
+
+
+// ------------------------------------
+// A right-hand side or Jacobian F of ../*/system.h counting its
+// evaluations into counter C. It derives from F, so that the members
+// of F stay accessible.
+// ------------------------------------
+template< class F , counter_id C >
+struct counted_function : F
+{
+    counted_function( vector<double> &full_param ) : F( full_param ) { }
+
+    template< class... Args >
+    void operator()( Args&&... args ) const
+    {
+        count_event( C );
+        F::operator()( std::forward< Args >( args )... );
+    }
+};
+
+template< class F > using counted_rhs = counted_function< F , rhs_count >;
+template< class F > using counted_jacobian = counted_function< F , jacobian_count >;
+
+
+// ------------------------------------
+// JSON of all blocks: {"threads" (the blocks), "counters", "timers" (calls, seconds,
+// histogram of [below_us, count]), "calls" (the records of every
+// thread in turn), "dropped_calls"}
+// ------------------------------------
+inline void write_counters( ostream &out )
+{
+    counter_registry &r = counter_state();
+    lock_guard< mutex > lock( r.m );
+
+    uint64_t counts[n_counters] = { 0 } , calls[n_timers] = { 0 } , nanoseconds[n_timers] = { 0 } , histogram[n_timers][counter_histogram_buckets] = { { 0 } } , dropped = 0;
+    for( size_t i=0 ; i<r.blocks.size() ; ++i )
+    {
+        counter_block &b = *r.blocks[i];
+        for( int c=0 ; c<n_counters ; ++c )
+            counts[c] += b.counts[c].load( memory_order_relaxed );
+        for( int k=0 ; k<n_timers ; ++k )
+        {
+            calls[k] += b.calls[k].load( memory_order_relaxed );
+            nanoseconds[k] += b.nanoseconds[k].load( memory_order_relaxed );
+            for( size_t h=0 ; h<counter_histogram_buckets ; ++h )
+                histogram[k][h] += b.histogram[k][h].load( memory_order_relaxed );
+        }
+        lock_guard< mutex > records_lock( b.records_mutex );
+        dropped += b.dropped_records;
+    }
+
+    out << "{\n  \"threads\": " << r.blocks.size() << ",\n  \"counters\": {";
+    for( int c=0 ; c<n_counters ; ++c )
+        out << (c ? ", " : " ") << "\"" << counter_name( c ) << "\": " << counts[c];
+    out << " },\n  \"timers\": {";
+    for( int k=0 ; k<n_timers ; ++k )
+    {
+        out << (k ? "," : "") << "\n    \"" << timer_name( k ) << "\": { \"calls\": " << calls[k] << ", \"seconds\": " << 1E-9*nanoseconds[k] << ", \"histogram\": [";
+        bool first = true;
+        for( size_t h=0 ; h<counter_histogram_buckets ; ++h )
+            if( histogram[k][h] )
+            {
+                out << (first ? "" : ", ") << "[" << (uint64_t( 1 ) << h) << ", " << histogram[k][h] << "]";
+                first = false;
+            }
+        out << "] }";
+    }
+    out << "\n  },\n  \"calls\": [";
+    bool first = true;
+    for( size_t i=0 ; i<r.blocks.size() ; ++i )
+    {
+        counter_block &b = *r.blocks[i];
+        lock_guard< mutex > records_lock( b.records_mutex );
+        for( size_t j=0 ; j<b.records.size() ; ++j )
+        {
+            const call_record &c = b.records[j];
+            out << (first ? "\n" : ",\n") << "    { \"call\": \"" << timer_name( c.timer ) << "\", \"thread\": " << i << ", \"start\": " << c.start << ", \"seconds\": " << c.seconds;
+            for( int k=0 ; k<n_counters ; ++k )
+                out << ", \"" << counter_name( k ) << "\": " << c.counts[k];
+            for( int k=n_call_timers ; k<n_timers ; ++k )
+                out << ", \"" << timer_name( k ) << "_seconds\": " << c.phase_seconds[k-n_call_timers];
+            out << " }";
+            first = false;
+        }
+    }
+    out << (first ? "" : "\n  ") << "],\n  \"dropped_calls\": " << dropped << "\n}\n";
+}
+
+
+inline bool write_counters( const string &fnm )
+{
+    ofstream out( fnm.c_str() );
+    if( !out )
+    {
+        cerr << "write_counters: cannot write " << fnm << endl;
+        return false;
+    }
+    write_counters( out );
+    return true;
+}
+
+
+inline void write_counters_at_exit()
+{
+    counter_registry &r = counter_state();
+    if( !r.blocks.empty() )
+        write_counters( r.file );
+}
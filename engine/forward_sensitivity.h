@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <boost/numeric/ublas/matrix.hpp>
+
+#include "adaint.h"
+#include "replay.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Right-hand side of a model augmented with n_columns columns C_c of
+// its dimension: the state is x followed by the columns and
+//     dC_c/dt = J(x) C_c + b_c
+// with J the analytic Jacobian of the model. source( c , x , t , b )
+// adds b_c to b (zero on entry); the variational equation has none.
+// ------------------------------------
+template< class ModelState , class System , class Jacobian , class Source >
+void augmented_rhs( const System &f , const Jacobian &jac , size_t n_columns , Source source , const vector<double> &X , vector<double> &dXdt , const double t )
+{
+    ModelState x , dxdt , dfdt , b;
+    size_t dim = x.size();
+    std::copy( X.begin() , X.begin()+dim , x.begin() );
+    f( x , dxdt , t );
+    std::copy( dxdt.begin() , dxdt.end() , dXdt.begin() );
+
+    boost::numeric::ublas::bounded_matrix< double , ModelState::static_size , ModelState::static_size > J;
+    jac( x , J , t , dfdt );
+    for( size_t c=0 ; c<n_columns ; ++c )
+    {
+        const double *C = X.data() + (c+1)*dim;
+        double *dC = dXdt.data() + (c+1)*dim;
+        std::fill( b.begin() , b.end() , 0.0 );
+        source( c , x , t , b );
+        for( size_t i=0 ; i<dim ; ++i )
+        {
+            double v = b[i];
+            for( size_t k=0 ; k<dim ; ++k )
+                v += J( i , k )*C[k];
+            dC[i] = v;
+        }
+    }
+}
+
+
+// ------------------------------------
+// Right-hand side of a model augmented with its forward sensitivities
+// S_j = dx/dp_j for every parameter of full_param (p0 followed by Amax):
+//     dS_j/dt = J(x) S_j + df/dp_j
+// The state is x followed by S_0, ..., S_{n-1} (n_p+1 blocks of dim).
+// J comes from the analytic Jacobian of the model, df/dp_j from central
+// differences of the right-hand side (exact up to round-off for the
+// mass-action terms, which are linear in each parameter).
+// ------------------------------------
+template< class System , class Jacobian , class ModelState >
+struct sensitivity_rhs
+{
+    System m_f;
+    Jacobian m_jac;
+    vector< System > m_plus;
+    vector< System > m_minus;
+    vector< double > m_h;
+
+    sensitivity_rhs( vector<double> &full_param ) : m_f( full_param ) , m_jac( full_param )
+    {
+        for( size_t j=0 ; j<full_param.size() ; ++j )
+        {
+            double h = 1E-6*max( abs( full_param[j] ) , 1E-8 );
+            vector<double> p = full_param;
+            p[j] = full_param[j] + h;
+            m_plus.push_back( System( p ) );
+            p[j] = full_param[j] - h;
+            m_minus.push_back( System( p ) );
+            m_h.push_back( h );
+        }
+    }
+
+    void operator()( const vector<double> &X , vector<double> &dXdt , const double t ) const
+    {
+        augmented_rhs< ModelState >( m_f , m_jac , m_h.size() , [this]( size_t j , const ModelState &x , double t , ModelState &df ) {
+            ModelState fp , fm;
+            m_plus[j]( x , fp , t );
+            m_minus[j]( x , fm , t );
+            for( size_t i=0 ; i<df.size() ; ++i )
+                df[i] = (fp[i] - fm[i])/(2.0*m_h[j]);
+        } , X , dXdt , t );
+    }
+};
+
+
+// ------------------------------------
+// Systems of habituate for the augmented state. The bounds and the
+// output only look at the model state, so habituate, the criteria and
+// the peaks are those of the explicit stepper.
+// ------------------------------------
+template< class Model >
+struct sensitivity_systems
+{
+    typedef vector< double > state_type;
+    typedef typename Model::state_type model_state_type;
+
+    sensitivity_rhs< typename Model::system_on , typename Model::jacobian_on , model_state_type > on;
+    sensitivity_rhs< typename Model::system_off , typename Model::jacobian_off , model_state_type > off;
+    int jac_on;                 // unused by explicit_stepper
+    int jac_off;
+    size_t output;
+    size_t n_parameters;
+
+    sensitivity_systems( vector<double> &full_param ) : on( full_param ) , off( full_param ) , jac_on( 0 ) , jac_off( 0 ) , output( Model::output ) , n_parameters( full_param.size() ) { }
+
+    model_state_type expand( const state_type &X , bool stimulated ) const
+    {
+        model_state_type x;
+        std::copy( X.begin() , X.begin()+x.size() , x.begin() );
+        return x;
+    }
+
+    double output_value( const state_type &X , bool stimulated ) const { return X[output]; }
+
+    // d output / d p_j of an augmented state
+    double output_gradient( const state_type &X , size_t j ) const { return X[(j+1)*model_state_type().size() + output]; }
+};
+
+
+// peaks of the habituation with their gradients, gradient[k][j] =
+// d peaks_level[k] / d full_param[j] (p0 followed by Amax)
+struct peak_gradients
+{
+    vector<double> peaks_level;
+    vector<double> peaks_time;
+    vector< vector<double> > gradient;
+    int ht;                     // periods integrated, as habituation_data::ht
+};
+
+
+// ------------------------------------
+// Habituation protocol of adaint (explicit stepper) integrated once
+// with the forward sensitivities. The habituation keeps only the
+// checkpoints (replay.h); the state at every peak is replayed from its
+// phase. The gradient of a peak is that of the output at the sample
+// where it is reached. Returns false if the run is rejected.
+// ------------------------------------
+template< class Model >
+bool peak_sensitivities( peak_gradients &g , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    sensitivity_systems< Model > s( full_param );
+    explicit_stepper stepper( opt.abs_tol , opt.rel_tol );
+
+    adaint_options o = opt;
+    o.checkpoints = 1;
+    size_t dim = x0.size();
+    vector<double> X0( dim*(full_param.size()+1) , 0.0 );
+    std::copy( x0.begin() , x0.end() , X0.begin() );
+
+    habituation_data< vector<double> > data;
+    if( !habituate( data , s , stepper , T , X0 , o ) )
+        return false;
+
+    g.peaks_level = data.peaks_level;
+    g.peaks_time = data.peaks_time;
+    g.ht = data.ht;
+    g.gradient.assign( data.peaks_level.size() , vector<double>( full_param.size() ) );
+    vector<double> X;
+    double t;
+    for( size_t k=0 ; k<data.peaks_time.size() ; ++k )
+    {
+        habituation_sample( X , t , data , s , stepper , size_t( llround( data.peaks_time[k]/opt.step_size ) ) , T , o );
+        for( size_t j=0 ; j<full_param.size() ; ++j )
+            g.gradient[k][j] = s.output_gradient( X , j );
+    }
+    return true;
+}
+
+
+// mean decay of the log peaks per period, (log p_last - log p_first)/(n-1),
+// and its gradient
+inline double peak_decay_rate( const peak_gradients &g , vector<double> &gradient )
+{
+    size_t n = g.peaks_level.size();
+    gradient.assign( g.gradient.empty() ? 0 : g.gradient[0].size() , 0.0 );
+    if( n < 2 )
+        return 0.0;
+    double first = g.peaks_level[0] , last = g.peaks_level[n-1];
+    for( size_t j=0 ; j<gradient.size() ; ++j )
+        gradient[j] = (g.gradient[n-1][j]/last - g.gradient[0][j]/first)/(n-1);
+    return (log( last ) - log( first ))/(n-1);
+}
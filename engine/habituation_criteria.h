@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cmath>
+
+
+// ------------------------------------
+// Habituation criteria of the python code, fed one peak per period
+// with O(1) memory.
+// ------------------------------------
+
+// calc_util.sliding_maxnorm_ht: the peaks are cropped at the (first)
+// maximum and scanned from the tail for the last step that still
+// drops by more than threshold (or drops to ~0); ht counts the peaks
+// up to that step. The scan from the tail is the same as remembering
+// the last such step going forward.
+struct sliding_maxnorm_ht
+{
+    double m_threshold;
+    int m_n;                // peaks seen
+    int m_max_index;
+    double m_max;
+    double m_first_after_max;
+    double m_last;
+    double m_before_last;
+    int m_last_drop;        // index (from the max) of the last large drop, 0 if none
+
+    sliding_maxnorm_ht( double threshold ) : m_threshold( threshold ) , m_n( 0 ) , m_max_index( 0 ) , m_max( 0.0 ) ,
+        m_first_after_max( 0.0 ) , m_last( 0.0 ) , m_before_last( 0.0 ) , m_last_drop( 0 ) { }
+
+    void push( double peak )
+    {
+        if( (m_n == 0) || (peak > m_max) )
+        {
+            m_max_index = m_n;
+            m_max = peak;
+            m_last_drop = 0;
+        }
+        else
+        {
+            int i = m_n - m_max_index;
+            if( i == 1 )
+                m_first_after_max = peak;
+            if( (1 - peak/m_last > m_threshold) || ((m_last > 1e-5) && (peak < 1e-5) && (m_max > 1e-3)) )
+                m_last_drop = i;
+        }
+        m_before_last = m_last;
+        m_last = peak;
+        ++m_n;
+    }
+
+    // habituation time in periods, 0 if not habituated
+    int ht() const
+    {
+        int i = m_n - m_max_index - 1;      // last index of the cropped peaks
+        if( (i <= 0) || (m_threshold < 1 - m_last/m_before_last) )
+            return 0;
+        if( 1 - m_first_after_max/m_max < m_threshold )
+            return 0;
+        if( m_last_drop == 0 )
+            return 0;
+        return m_max_index + m_last_drop + 1;
+    }
+};
+
+
+// Stopping rule of adaint.integrate: stop after steady_counter_threshold
+// successive periods whose peak is below min_output_level or drops by
+// less than int_threshold, or after increasing_counter_threshold
+// (not necessarily successive) increasing peaks. Tests start with the
+// third peak.
+struct python_stopping_rule
+{
+    double m_int_threshold;
+    double m_min_output_level;
+    int m_steady_threshold;
+    int m_increasing_threshold;
+    int m_n;
+    int m_steady;
+    int m_increasing;
+    double m_last;
+
+    python_stopping_rule( double int_threshold , double min_output_level , int steady_threshold , int increasing_threshold )
+    : m_int_threshold( int_threshold ) , m_min_output_level( min_output_level ) , m_steady_threshold( steady_threshold ) ,
+      m_increasing_threshold( increasing_threshold ) , m_n( 0 ) , m_steady( 0 ) , m_increasing( 0 ) , m_last( 0.0 ) { }
+
+    // true when the integration stops after this peak
+    bool push( double peak )
+    {
+        bool stop = false;
+        if( ++m_n > 2 )
+        {
+            if( peak >= m_last )
+                stop = (++m_increasing >= m_increasing_threshold);
+            if( !stop )
+            {
+                if( m_last < m_min_output_level )
+                    ++m_steady;
+                else if( 1 - peak/m_last < m_int_threshold )
+                    ++m_steady;
+                else
+                    m_steady = 0;
+                stop = (m_steady >= m_steady_threshold);
+            }
+        }
+        m_last = peak;
+        return stop;
+    }
+};
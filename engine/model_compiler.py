@@ -0,0 +1,553 @@
+"""Compiles an ODE model written as in the notebooks into a C++ model header for the engine.
+
+The model is a python function
+
+    def f_R_NF(X, t, S, k1, k2, k3, kMa, kIa2, kIi2, kRa2, kRi2, kMa2, kMi2):
+        Ri, Rr, Ra, I2, M2, R2 = X
+        dRi = k3*Rr - k1*S*Ri
+        ...
+        return(dRi, dRr, dRa, dI2, dM2, dR2)
+
+in a .py file or in a code cell of a notebook. S is the stimulus: the ON system uses S = Amax (appended
+after the parameters, as in the hand-written system.h files), the OFF system S = 0.
+Only + - * / and ** with a constant exponent are supported; intermediate assignments are inlined.
+
+The header contains IFF_concat_MAX/MIN with the right-hand sides, IFF_concat_MAX/MIN_jacobian with the
+analytic Jacobians (common subexpressions computed once) and the IFF_concat description, including the
+conservation laws (found exactly with rational arithmetic) and the parameter and variable names.
+
+    python3 engine/model_compiler.py paper_figures_all.ipynb f_R_NF -o system.h --output 5 --stiff --fast 0,1,2
+"""
+
+import argparse
+import ast
+import json
+import random
+from fractions import Fraction
+from math import gcd
+
+
+### expressions ###################################################################
+# Expressions are nested tuples, so equal subexpressions are equal keys:
+# ('num', v), ('var', i), ('par', j), ('add', a, b), ('sub', a, b), ('mul', a, b),
+# ('div', a, b), ('neg', a), ('pow', a, n)
+
+ZERO = ('num', 0.0)
+ONE = ('num', 1.0)
+
+def num(v):
+    return ('num', float(v))
+
+def is_num(e, v=None):
+    return e[0] == 'num' and (v is None or e[1] == v)
+
+def ordered(a, b):
+    """Operands of + and * in a fixed order, so that a*b and b*a are shared (exact in floating point)."""
+    return (a, b) if repr(a) <= repr(b) else (b, a)
+
+def add(a, b):
+    if is_num(a) and is_num(b):
+        return num(a[1] + b[1])
+    if is_num(a, 0.0):
+        return b
+    if is_num(b, 0.0):
+        return a
+    if b[0] == 'neg':
+        return sub(a, b[1])
+    if a[0] == 'neg':
+        return sub(b, a[1])
+    return ('add',) + ordered(a, b)
+
+def sub(a, b):
+    if is_num(a) and is_num(b):
+        return num(a[1] - b[1])
+    if is_num(b, 0.0):
+        return a
+    if is_num(a, 0.0):
+        return neg(b)
+    if a == b:
+        return ZERO
+    if b[0] == 'neg':
+        return add(a, b[1])
+    return ('sub', a, b)
+
+def mul(a, b):
+    if is_num(a) and is_num(b):
+        return num(a[1] * b[1])
+    if is_num(a, 0.0) or is_num(b, 0.0):
+        return ZERO
+    if is_num(a, 1.0):
+        return b
+    if is_num(b, 1.0):
+        return a
+    if is_num(a, -1.0):
+        return neg(b)
+    if is_num(b, -1.0):
+        return neg(a)
+    if a[0] == 'neg':
+        return neg(mul(a[1], b))
+    if b[0] == 'neg':
+        return neg(mul(a, b[1]))
+    return ('mul',) + ordered(a, b)
+
+def div(a, b):
+    if is_num(a, 0.0):
+        return ZERO
+    if is_num(b, 1.0):
+        return a
+    if is_num(a) and is_num(b) and b[1] != 0.0:
+        return num(a[1] / b[1])
+    if a[0] == 'neg':
+        return neg(div(a[1], b))
+    return ('div', a, b)
+
+def neg(a):
+    if is_num(a):
+        return num(-a[1])
+    if a[0] == 'neg':
+        return a[1]
+    return ('neg', a)
+
+def power(a, n):
+    if n == 0:
+        return ONE
+    if n == 1:
+        return a
+    if n == 2:
+        return mul(a, a)
+    if is_num(a):
+        return num(a[1] ** n)
+    return ('pow', a, float(n))
+
+
+def substitute(e, stimulus):
+    """Replaces the stimulus ('S',) by an expression and simplifies."""
+    kind = e[0]
+    if kind == 'S':
+        return stimulus
+    if kind in ('num', 'var', 'par'):
+        return e
+    if kind == 'neg':
+        return neg(substitute(e[1], stimulus))
+    if kind == 'pow':
+        return power(substitute(e[1], stimulus), e[2])
+    a, b = substitute(e[1], stimulus), substitute(e[2], stimulus)
+    return {'add': add, 'sub': sub, 'mul': mul, 'div': div}[kind](a, b)
+
+
+def derivative(e, i):
+    """d e / d x[i]"""
+    kind = e[0]
+    if kind in ('num', 'par', 'S'):
+        return ZERO
+    if kind == 'var':
+        return ONE if e[1] == i else ZERO
+    if kind == 'neg':
+        return neg(derivative(e[1], i))
+    if kind == 'pow':
+        return mul(mul(num(e[2]), power(e[1], e[2] - 1)), derivative(e[1], i))
+    a, b = e[1], e[2]
+    da, db = derivative(a, i), derivative(b, i)
+    if kind == 'add':
+        return add(da, db)
+    if kind == 'sub':
+        return sub(da, db)
+    if kind == 'mul':
+        return add(mul(da, b), mul(a, db))
+    # quotient rule
+    if is_num(db, 0.0):
+        return div(da, b)
+    if is_num(da, 0.0):
+        return neg(div(mul(a, db), mul(b, b)))
+    return div(sub(mul(da, b), mul(a, db)), mul(b, b))
+
+
+def evaluate(e, x, p, s):
+    kind = e[0]
+    if kind == 'num':
+        return Fraction(e[1]) if isinstance(s, Fraction) else e[1]
+    if kind == 'var':
+        return x[e[1]]
+    if kind == 'par':
+        return p[e[1]]
+    if kind == 'S':
+        return s
+    if kind == 'neg':
+        return -evaluate(e[1], x, p, s)
+    if kind == 'pow':
+        n = e[2]
+        if isinstance(s, Fraction) and n != int(n):
+            raise ValueError("non integer exponent")
+        return evaluate(e[1], x, p, s) ** (int(n) if n == int(n) else n)
+    a, b = evaluate(e[1], x, p, s), evaluate(e[2], x, p, s)
+    if kind == 'add':
+        return a + b
+    if kind == 'sub':
+        return a - b
+    if kind == 'mul':
+        return a * b
+    return a / b
+
+
+### parsing #######################################################################
+
+class ModelParser:
+    """Turns the body of the model function into one expression per variable."""
+
+    def __init__(self, fdef):
+        args = [a.arg for a in fdef.args.args]
+        if len(args) < 3 or args[2] != 'S':
+            raise ValueError("expected f(X, t, S, parameters...)")
+        self.state_name = args[0]
+        self.time_name = args[1]
+        self.parameter_names = args[3:]
+        self.variable_names = []
+        self.symbols = {'S': ('S',)}
+        for j, name in enumerate(self.parameter_names):
+            self.symbols[name] = ('par', j)
+        self.rhs = None
+        for statement in fdef.body:
+            self.statement(statement)
+        if self.rhs is None:
+            raise ValueError("no return statement")
+        if not self.variable_names:  # only X[i] in the body
+            self.variable_names = ["x%d" % i for i in range(len(self.rhs))]
+        if len(self.rhs) != len(self.variable_names):
+            raise ValueError("%d variables but %d derivatives" % (len(self.variable_names), len(self.rhs)))
+
+    def statement(self, node):
+        if isinstance(node, ast.Expr) and isinstance(node.value, ast.Constant):
+            return  # docstring
+        if isinstance(node, ast.Assign) and len(node.targets) == 1:
+            target = node.targets[0]
+            if isinstance(target, (ast.Tuple, ast.List)) and isinstance(node.value, ast.Name) and node.value.id == self.state_name:
+                for i, element in enumerate(target.elts):
+                    self.variable_names.append(element.id)
+                    self.symbols[element.id] = ('var', i)
+                return
+            if isinstance(target, ast.Name):
+                self.symbols[target.id] = self.expression(node.value)
+                return
+        if isinstance(node, ast.Return):
+            value = node.value
+            elements = value.elts if isinstance(value, (ast.Tuple, ast.List)) else [value]
+            self.rhs = [self.expression(element) for element in elements]
+            return
+        raise ValueError("unsupported statement at line %d" % node.lineno)
+
+    def expression(self, node):
+        if isinstance(node, ast.Constant) and isinstance(node.value, (int, float)):
+            return num(node.value)
+        if isinstance(node, ast.Name):
+            if node.id not in self.symbols:
+                raise ValueError("unknown name %s at line %d" % (node.id, node.lineno))
+            return self.symbols[node.id]
+        if isinstance(node, ast.Subscript) and isinstance(node.value, ast.Name) and node.value.id == self.state_name:
+            index = node.slice.value if isinstance(node.slice, ast.Constant) else node.slice.value.value
+            return ('var', index)
+        if isinstance(node, ast.UnaryOp) and isinstance(node.op, (ast.USub, ast.UAdd)):
+            operand = self.expression(node.operand)
+            return neg(operand) if isinstance(node.op, ast.USub) else operand
+        if isinstance(node, ast.BinOp):
+            a = self.expression(node.left)
+            if isinstance(node.op, ast.Pow):
+                b = self.expression(node.right)
+                if not is_num(b):
+                    raise ValueError("only constant exponents are supported (line %d)" % node.lineno)
+                return power(a, b[1])
+            b = self.expression(node.right)
+            operations = {ast.Add: add, ast.Sub: sub, ast.Mult: mul, ast.Div: div}
+            if type(node.op) in operations:
+                return operations[type(node.op)](a, b)
+        raise ValueError("unsupported expression at line %d" % node.lineno)
+
+
+def find_function(filename, function):
+    """Returns the ast of the function, from a .py file or from the code cells of a notebook."""
+    if filename.endswith('.ipynb'):
+        with open(filename) as f:
+            notebook = json.load(f)
+        sources = [''.join(cell['source']) for cell in notebook['cells'] if cell['cell_type'] == 'code']
+    else:
+        with open(filename) as f:
+            sources = [f.read()]
+    for source in sources:
+        try:
+            tree = ast.parse(source)
+        except SyntaxError:  # ipython magics
+            continue
+        for node in ast.walk(tree):
+            if isinstance(node, ast.FunctionDef) and node.name == function:
+                return node
+    raise ValueError("function %s not found in %s" % (function, filename))
+
+
+### conservation laws #############################################################
+
+def nullspace(rows, n):
+    """Exact null space of a matrix of Fractions with n columns."""
+    rows = [list(r) for r in rows]
+    pivots = []
+    r = 0
+    for c in range(n):
+        p = next((k for k in range(r, len(rows)) if rows[k][c] != 0), None)
+        if p is None:
+            continue
+        rows[r], rows[p] = rows[p], rows[r]
+        pivot = rows[r][c]
+        rows[r] = [v / pivot for v in rows[r]]
+        for k in range(len(rows)):
+            if k != r and rows[k][c] != 0:
+                factor = rows[k][c]
+                rows[k] = [a - factor * b for a, b in zip(rows[k], rows[r])]
+        pivots.append(c)
+        r += 1
+    basis = []
+    for free in (c for c in range(n) if c not in pivots):
+        v = [Fraction(0)] * n
+        v[free] = Fraction(1)
+        for k, c in enumerate(pivots):
+            v[c] = -rows[k][free]
+        basis.append(v)
+    return basis
+
+
+def conservation_laws(rhs, n_parameters, samples=None):
+    """Vectors c with sum_i c_i f_i = 0 for any state, parameters and stimulus, with integer entries."""
+    n = len(rhs)
+    samples = samples or n + 5
+    rng = random.Random(1)
+    try:
+        rows = []
+        for k in range(samples):
+            x = [Fraction(rng.randint(1, 97), 101) for i in range(n)]
+            p = [Fraction(rng.randint(1, 97), 37) for j in range(n_parameters)]
+            s = Fraction(rng.randint(0, 97), 13) if k % 2 else Fraction(0)
+            rows.append([evaluate(f, x, p, s) for f in rhs])
+    except (ValueError, ZeroDivisionError):
+        return []
+    laws = []
+    for v in nullspace(rows, n):
+        scale = 1
+        for value in v:
+            scale = scale * value.denominator // gcd(scale, value.denominator)
+        integers = [int(value * scale) for value in v]
+        common = 0
+        for value in integers:
+            common = gcd(common, abs(value))
+        laws.append([value // common for value in integers])
+    return laws
+
+
+### code generation ###############################################################
+
+PRECEDENCE = {'add': 1, 'sub': 1, 'mul': 2, 'div': 2, 'neg': 3}
+OPERATOR = {'add': ' + ', 'sub': ' - ', 'mul': '*', 'div': '/'}
+
+def format_number(v):
+    if v == int(v) and abs(v) < 1e15:
+        return "%.1f" % v
+    return repr(v)
+
+
+class Printer:
+    """Prints expressions as C++, subexpressions used more than once go to const temporaries."""
+
+    def __init__(self, roots, parameter):
+        self.parameter = parameter
+        self.count = {}
+        self.order = []
+        for root in roots:
+            self.visit(root)
+        self.names = {}
+        self.temporaries = []
+        for e in self.order:
+            if self.count[e] > 1 and e[0] not in ('num', 'var', 'par', 'neg'):
+                self.temporaries.append((e, self.text(e, 0, top=True)))
+                self.names[e] = "c%d" % (len(self.names))
+
+    def visit(self, e):
+        self.count[e] = self.count.get(e, 0) + 1
+        if self.count[e] > 1 or e[0] in ('num', 'var', 'par'):
+            return
+        for child in e[1:]:
+            if isinstance(child, tuple):
+                self.visit(child)
+        self.order.append(e)
+
+    def text(self, e, parent, right=False, top=False):
+        if not top and e in self.names:
+            return self.names[e]
+        kind = e[0]
+        if kind == 'num':
+            s = format_number(e[1])
+            return "(%s)" % s if e[1] < 0 and parent > 0 else s
+        if kind == 'var':
+            return "x[%d]" % e[1]
+        if kind == 'par':
+            return self.parameter(e[1])
+        if kind == 'pow':
+            return "pow(%s, %s)" % (self.text(e[1], 0), format_number(e[2]))
+        if kind == 'neg':
+            # -(a*b) is -a*b in floating point
+            s = "-" + self.text(e[1], PRECEDENCE['mul'])
+            return "(%s)" % s if parent > 1 else s
+        prec = PRECEDENCE[kind]
+        s = self.text(e[1], prec) + OPERATOR[kind] + self.text(e[2], prec, right=True)
+        if prec < parent or (right and prec == parent and parent in (1, 2)):
+            return "(%s)" % s
+        return s
+
+    def declarations(self, indent):
+        lines = []
+        for e, text in self.temporaries:
+            lines.append("%sconst double %s = %s;" % (indent, self.names[e], text))
+        return lines
+
+
+def parameter_text(j):
+    return "m_gam[%d]" % j
+
+
+def system_class(name, rhs):
+    printer = Printer(rhs, parameter_text)
+    indent = " " * 8
+    lines = ["class %s {" % name,
+             "    vector<double> m_gam;",
+             "public:",
+             "    %s( vector<double> &gam ) : m_gam(gam) { }" % name,
+             "    template< class State >",
+             "    void operator() (const State &x, State &dxdt, const double t) const {"]
+    lines += printer.declarations(indent)
+    for i, f in enumerate(rhs):
+        lines.append("%sdxdt[%d] = %s;" % (indent, i, printer.text(f, 0)))
+    lines += ["    }", "};"]
+    return lines
+
+
+def jacobian_class(name, rhs):
+    n = len(rhs)
+    entries = [(i, j, derivative(f, j)) for i, f in enumerate(rhs) for j in range(n)]
+    entries = [(i, j, d) for i, j, d in entries if not is_num(d, 0.0)]
+    printer = Printer([d for i, j, d in entries], parameter_text)
+    indent = " " * 8
+    lines = ["class %s {" % name,
+             "    vector<double> m_gam;",
+             "public:",
+             "    %s( vector<double> &gam ) : m_gam(gam) { }" % name,
+             "    template< class State , class Matrix >",
+             "    void operator() (const State &x, Matrix &J, const double t, State &dfdt) const {",
+             indent + "J.clear();"]
+    lines += printer.declarations(indent)
+    for i, j, d in entries:
+        lines.append("%sJ(%d,%d) = %s;" % (indent, i, j, printer.text(d, 0)))
+    lines += [indent + "for( size_t i=0 ; i<%d ; ++i )" % n,
+              indent + "    dfdt[i] = 0.0;",
+              "    }", "};"]
+    return lines
+
+
+def law_text(law, names):
+    terms = []
+    for value, name in zip(law, names):
+        if value == 0:
+            continue
+        coefficient = "" if abs(value) == 1 else "%d " % abs(value)
+        sign = "-" if value < 0 else "+"
+        terms.append((sign, coefficient + name))
+    text = ("-" if terms[0][0] == "-" else "") + terms[0][1]
+    for sign, term in terms[1:]:
+        text += " %s %s" % (sign, term)
+    return text
+
+
+def model_header(model, source, function, output, stiff, fast):
+    n = len(model.variable_names)
+    n_parameters = len(model.parameter_names)
+    amax = ('par', n_parameters)
+    rhs_on = [substitute(f, amax) for f in model.rhs]
+    rhs_off = [substitute(f, ZERO) for f in model.rhs]
+    laws = conservation_laws(model.rhs, n_parameters)
+
+    lines = ["#pragma once",
+             "",
+             "// Generated by engine/model_compiler.py from %s (%s), do not edit." % (source, function),
+             "// m_gam: %s, Amax" % ", ".join(model.parameter_names),
+             "// x: %s" % ", ".join(model.variable_names),
+             "",
+             "#include <iostream>",
+             "#include <fstream>",
+             "#include <string>",
+             "#include<boost/array.hpp>",
+             "#include <boost/numeric/odeint.hpp>",
+             "",
+             "using namespace std;",
+             "",
+             "",
+             "typedef boost::array< double , %d > state_type;" % n,
+             "",
+             "",
+             "// Define the class that represents the system"]
+    lines += system_class("IFF_concat_MAX", rhs_on)
+    lines.append("")
+    lines += system_class("IFF_concat_MIN", rhs_off)
+    lines += ["", "", "// Analytic Jacobians, needed by the implicit (rosenbrock4) steppers"]
+    lines += jacobian_class("IFF_concat_MAX_jacobian", rhs_on)
+    lines.append("")
+    lines += jacobian_class("IFF_concat_MIN_jacobian", rhs_off)
+
+    def strings(names):
+        return ", ".join('"%s"' % name for name in names)
+
+    def doubles(law):
+        return "{" + ", ".join(format_number(v) for v in law) + "}"
+
+    lines += ["", "",
+              "// Description of the model for the shared engine (../engine)",
+              "struct IFF_concat {",
+              "    typedef ::state_type state_type;",
+              "    typedef IFF_concat_MAX system_on;",
+              "    typedef IFF_concat_MIN system_off;",
+              "    typedef IFF_concat_MAX_jacobian jacobian_on;",
+              "    typedef IFF_concat_MIN_jacobian jacobian_off;",
+              "    static const size_t output = %d;" % output,
+              "    static const bool stiff = %s;" % ("true" if stiff else "false")]
+    for law in laws:
+        lines.append("    // %s is conserved by both systems" % law_text(law, model.variable_names))
+    lines += ["    static const size_t n_conserved = %d;" % len(laws),
+              "    static vector< vector<double> > conservation_laws() { return { %s }; }" % ", ".join(doubles(law) for law in laws),
+              "    // fast variables for the quasi-steady state reduction",
+              "    static const size_t n_fast = %d;" % len(fast),
+              "    static vector< size_t > fast_variables() { return { %s }; }" % ", ".join(str(i) for i in fast),
+              "    // names of the parameters (p0 followed by Amax) and of the variables",
+              "    static const size_t n_parameters = %d;" % (n_parameters + 1),
+              "    static vector< string > parameter_names() { return { %s }; }" % strings(model.parameter_names + ["Amax"]),
+              "    static vector< string > variable_names() { return { %s }; }" % strings(model.variable_names),
+              "};",
+              ""]
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generates a C++ model header for ../engine from a python ODE function.")
+    parser.add_argument("source", help=".py file or notebook containing the function")
+    parser.add_argument("function", help="name of the function, e.g. f_R_NF")
+    parser.add_argument("-o", "--out", default="system.h", help="header to write")
+    parser.add_argument("--output", type=int, default=-1, help="index of the output variable (default: last)")
+    parser.add_argument("--stiff", action="store_true", help="use the rosenbrock4 stepper by default")
+    parser.add_argument("--fast", default="", help="comma separated indices of the fast variables")
+    args = parser.parse_args()
+
+    model = ModelParser(find_function(args.source, args.function))
+    n = len(model.variable_names)
+    output = args.output % n
+    fast = [int(i) for i in args.fast.split(",") if i.strip()]
+    if any(i < 0 or i >= n for i in fast) or output in fast:
+        raise ValueError("fast variables must be state indices other than the output")
+
+    with open(args.out, "w") as f:
+        f.write(model_header(model, args.source, args.function, output, args.stiff, fast))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
+
+#include "thresholds.h"
+#include "recovery_index.h"
+#include "screening.h"
+
+
+using namespace std;
+
+
+// directory of the engine headers and of model_compiler.py
+#ifndef ENGINE_DIR
+#define ENGINE_DIR engine_directory( __FILE__ )
+#endif
+
+inline string engine_directory( const string &file )
+{
+    size_t slash = file.find_last_of( '/' );
+    return (slash == string::npos) ? string( "." ) : file.substr( 0 , slash );
+}
+
+
+// ------------------------------------
+// How a model is built into a shared object. The cache key is a hash
+// of the model source, of these options and of the engine headers, so
+// any change rebuilds and an unchanged model is only dlopen'ed.
+// ------------------------------------
+struct model_build_options
+{
+    string cache_dir;           // default $HABITUATION_MODEL_CACHE, else ./model_cache
+    string python;              // runs model_compiler.py for .py/.ipynb sources
+    string compiler;
+    string flags;
+    int output;                 // model_compiler.py --output (-1: last variable)
+    bool stiff;                 // model_compiler.py --stiff
+    string fast;                // model_compiler.py --fast, e.g. "0,1,2"
+
+    model_build_options() : python("python3"), compiler("g++"), flags("-O3"), output(-1), stiff(false)
+    {
+        const char *dir = getenv( "HABITUATION_MODEL_CACHE" );
+        cache_dir = dir ? dir : "model_cache";
+    }
+};
+
+
+// Result of model_compute: ht and rt as adaint_recovery, the
+// habituation trajectory (n_samples x dim, row major) and its peaks.
+// The arrays belong to the library until model_release.
+struct model_run
+{
+    double ht;
+    double rt;
+    size_t n_samples;
+    size_t dim;
+    size_t n_peaks;
+    const double *times;
+    const double *states;
+    const double *peaks_time;
+    const double *peaks_level;
+    void *owner;
+};
+
+
+// C interface of the shared objects, see model_wrapper_source
+extern "C" {
+typedef void (*model_describe_fn)( size_t* , size_t* , size_t* );
+typedef const char* (*model_name_fn)( size_t );
+typedef void (*model_rhs_fn)( const double* , double* , const double* , int );
+typedef double (*model_adaint_fn)( double , double , const double* , size_t , const double* , const adaint_options* );
+typedef double (*model_adaint_recovery_fn)( double* , double , double , const double* , size_t , const double* , const adaint_options* , int , const char* , int );
+typedef void (*model_compute_fn)( model_run* , double , double , const double* , size_t , const double* , const adaint_options* , int );
+typedef void (*model_release_fn)( model_run* );
+typedef size_t (*model_recovery_envelope_fn)( double* , double* , size_t , double , double , const double* , size_t , const double* , const adaint_options* , double );
+typedef double (*model_screened_adaint_recovery_fn)( double* , double , double , const double* , size_t , const double* , const adaint_options* , int , int* );
+typedef void (*model_adaint_recovery_thresholds_fn)( double* , double* , double , double , const double* , size_t , const double* , const adaint_options* , const double* , size_t , const double* , size_t , int );
+}
+
+
+// ------------------------------------
+// A model loaded from the cache. The functions take p0 without Amax
+// and x0 of size dim, like adaint<Model> and adaint_recovery<Model>.
+// ------------------------------------
+class runtime_model
+{
+    void *m_handle;
+    model_rhs_fn m_rhs;
+    model_adaint_fn m_adaint;
+    model_adaint_recovery_fn m_adaint_recovery;
+    model_compute_fn m_compute;
+    model_release_fn m_release;
+    model_adaint_recovery_thresholds_fn m_thresholds;
+    model_recovery_envelope_fn m_envelope;
+    model_screened_adaint_recovery_fn m_screened;
+
+    runtime_model( const runtime_model& );
+    runtime_model& operator=( const runtime_model& );
+
+public:
+    size_t dim;
+    size_t n_parameters;        // including Amax
+    size_t output;
+    vector< string > parameter_names;
+    vector< string > variable_names;
+    string library;
+
+    runtime_model() : m_handle( 0 ) , m_rhs( 0 ) , m_adaint( 0 ) , m_adaint_recovery( 0 ) , m_compute( 0 ) , m_release( 0 ) , m_thresholds( 0 ) , m_envelope( 0 ) , m_screened( 0 ) , dim( 0 ) , n_parameters( 0 ) , output( 0 ) { }
+    ~runtime_model() { close(); }
+
+    bool loaded() const { return m_handle != 0; }
+
+    void close()
+    {
+        if( m_handle )
+            dlclose( m_handle );
+        m_handle = 0;
+    }
+
+    bool open( const string &so )
+    {
+        close();
+        m_handle = dlopen( so.c_str() , RTLD_NOW | RTLD_LOCAL );
+        if( !m_handle )
+        {
+            cerr << "runtime_model: " << dlerror() << endl;
+            return false;
+        }
+        model_describe_fn describe = (model_describe_fn) dlsym( m_handle , "model_describe" );
+        model_name_fn parameter_name = (model_name_fn) dlsym( m_handle , "model_parameter_name" );
+        model_name_fn variable_name = (model_name_fn) dlsym( m_handle , "model_variable_name" );
+        m_rhs = (model_rhs_fn) dlsym( m_handle , "model_rhs" );
+        m_adaint = (model_adaint_fn) dlsym( m_handle , "model_adaint" );
+        m_adaint_recovery = (model_adaint_recovery_fn) dlsym( m_handle , "model_adaint_recovery" );
+        m_compute = (model_compute_fn) dlsym( m_handle , "model_compute" );
+        m_release = (model_release_fn) dlsym( m_handle , "model_release" );
+        m_thresholds = (model_adaint_recovery_thresholds_fn) dlsym( m_handle , "model_adaint_recovery_thresholds" );
+        m_envelope = (model_recovery_envelope_fn) dlsym( m_handle , "model_recovery_envelope" );
+        m_screened = (model_screened_adaint_recovery_fn) dlsym( m_handle , "model_screened_adaint_recovery" );
+        if( !describe || !parameter_name || !variable_name || !m_rhs || !m_adaint || !m_adaint_recovery || !m_compute || !m_release || !m_thresholds || !m_envelope || !m_screened )
+        {
+            cerr << "runtime_model: " << so << " is not a model library" << endl;
+            close();
+            return false;
+        }
+        describe( &dim , &n_parameters , &output );
+        parameter_names.clear();
+        variable_names.clear();
+        for( size_t j=0 ; j<n_parameters ; ++j )
+            parameter_names.push_back( parameter_name( j ) );
+        for( size_t i=0 ; i<dim ; ++i )
+            variable_names.push_back( variable_name( i ) );
+        library = so;
+        return true;
+    }
+
+    // full_param is p0 followed by Amax
+    void rhs( const vector<double> &x , vector<double> &dxdt , const vector<double> &full_param , bool stimulated ) const
+    {
+        dxdt.resize( dim );
+        m_rhs( x.data() , dxdt.data() , full_param.data() , stimulated );
+    }
+
+    double adaint( double T , double Amax , const vector<double> &p0 , const vector<double> &x0 , const adaint_options &opt = adaint_options() ) const
+    {
+        return m_adaint( T , Amax , p0.data() , p0.size() , x0.data() , &opt );
+    }
+
+    double adaint_recovery( vector<double> &result , double T , double Amax , const vector<double> &p0 , const vector<double> &x0 , const adaint_options &opt , int print , const char* fnm , int recovery_true ) const
+    {
+        result.resize( 2 );
+        return m_adaint_recovery( result.data() , T , Amax , p0.data() , p0.size() , x0.data() , &opt , print , fnm , recovery_true );
+    }
+
+    // adaint_recovery keeping the trajectory, run must be released
+    void compute( model_run &run , double T , double Amax , const vector<double> &p0 , const vector<double> &x0 , const adaint_options &opt , int recovery_true ) const
+    {
+        m_compute( &run , T , Amax , p0.data() , p0.size() , x0.data() , &opt , recovery_true );
+    }
+
+    void release( model_run &run ) const { m_release( &run ); }
+
+    // see thresholds.h
+    void adaint_recovery_thresholds( threshold_times &res , double T , double Amax , const vector<double> &p0 , const vector<double> &x0 , const adaint_options &opt ,
+                                     const vector<double> &ht_thresholds , const vector<double> &recovery_thresholds , int recovery_true ) const
+    {
+        res.n_recovery = recovery_thresholds.size();
+        res.ht.resize( ht_thresholds.size() );
+        res.rt.resize( ht_thresholds.size()*recovery_thresholds.size() );
+        m_thresholds( res.ht.data() , res.rt.data() , T , Amax , p0.data() , p0.size() , x0.data() , &opt ,
+                      ht_thresholds.data() , ht_thresholds.size() , recovery_thresholds.data() , recovery_thresholds.size() , recovery_true );
+    }
+
+    // see recovery_index.h, false if rejected or not habituated
+    bool recovery_envelope( vector<double> &rest_times , vector<double> &peaks , double T , double Amax , const vector<double> &p0 , const vector<double> &x0 , const adaint_options &opt ,
+                            double tolerance = 0.01 , size_t max_probes = 200 ) const
+    {
+        rest_times.resize( max_probes );
+        peaks.resize( max_probes );
+        size_t n = m_envelope( rest_times.data() , peaks.data() , max_probes , T , Amax , p0.data() , p0.size() , x0.data() , &opt , tolerance );
+        rest_times.resize( n );
+        peaks.resize( n );
+        return n > 0;
+    }
+
+    // see screening.h
+    double screened_adaint_recovery( vector<double> &result , double T , double Amax , const vector<double> &p0 , const vector<double> &x0 , const adaint_options &opt ,
+                                     int recovery_true , int *verified = 0 ) const
+    {
+        result.resize( 2 );
+        return m_screened( result.data() , T , Amax , p0.data() , p0.size() , x0.data() , &opt , recovery_true , verified );
+    }
+};
+
+
+// ------------------------------------
+// Cache key
+// ------------------------------------
+inline void fnv1a( unsigned long long &h , const string &s )
+{
+    for( size_t i=0 ; i<s.size() ; ++i )
+    {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= 0xff;      // separator, so that ("ab","c") and ("a","bc") differ
+    h *= 1099511628211ULL;
+}
+
+inline bool read_file( const string &fnm , string &content )
+{
+    ifstream file( fnm.c_str() , ios::binary );
+    if( !file )
+        return false;
+    stringstream ss;
+    ss << file.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+inline bool file_exists( const string &fnm )
+{
+    struct stat st;
+    return stat( fnm.c_str() , &st ) == 0;
+}
+
+inline string absolute_path( const string &fnm )
+{
+    if( !fnm.empty() && fnm[0] == '/' )
+        return fnm;
+    char cwd[4096];
+    if( !getcwd( cwd , sizeof(cwd) ) )
+        return fnm;
+    return string( cwd ) + "/" + fnm;
+}
+
+inline bool model_cache_key( string &key , const string &source , const string &function , const model_build_options &bopt )
+{
+    string content;
+    if( !read_file( source , content ) )
+    {
+        cerr << "load_model: cannot read " << source << endl;
+        return false;
+    }
+    unsigned long long h = 14695981039346656037ULL;
+    fnv1a( h , content );
+    fnv1a( h , function );
+    ostringstream settings;
+    settings << bopt.compiler << ' ' << bopt.flags << ' ' << bopt.output << ' ' << bopt.stiff << ' ' << bopt.fast;
+    fnv1a( h , settings.str() );
+    const char *engine_files[] = { "steppers.h" , "habituation_criteria.h" , "adaint.h" , "trajectory_sink.h" , "replay.h" , "parallel_for.h" , "parareal.h" , "adaint_recovery.h" , "thresholds.h" , "recovery_index.h" , "screening.h" , "counters.h" , "model_loader.h" , "model_compiler.py" };
+    for( size_t i=0 ; i<sizeof(engine_files)/sizeof(engine_files[0]) ; ++i )
+    {
+        if( !read_file( string( ENGINE_DIR ) + "/" + engine_files[i] , content ) )
+            content.clear();
+        fnv1a( h , content );
+    }
+    char hex[17];
+    snprintf( hex , sizeof(hex) , "%016llx" , h );
+    key = hex;
+    return true;
+}
+
+
+// C interface around a system header, compiled into the shared object
+inline string model_wrapper_source( const string &header )
+{
+    ostringstream src;
+    src << "#include \"" << header << "\"\n"
+        << "#include \"" << absolute_path( ENGINE_DIR ) << "/model_loader.h\"\n"
+        << "\n"
+        << "static const vector< string > parameter_names = IFF_concat::parameter_names();\n"
+        << "static const vector< string > variable_names = IFF_concat::variable_names();\n"
+        << "\n"
+        << "extern \"C\" {\n"
+        << "void model_describe( size_t *dim , size_t *n_parameters , size_t *output )\n"
+        << "{\n"
+        << "    *dim = state_type::static_size;\n"
+        << "    *n_parameters = IFF_concat::n_parameters;\n"
+        << "    *output = IFF_concat::output;\n"
+        << "}\n"
+        << "const char* model_parameter_name( size_t j ) { return parameter_names[j].c_str(); }\n"
+        << "const char* model_variable_name( size_t i ) { return variable_names[i].c_str(); }\n"
+        << "void model_rhs( const double *x , double *dxdt , const double *full_param , int stimulated )\n"
+        << "{\n"
+        << "    vector<double> gam( full_param , full_param + IFF_concat::n_parameters );\n"
+        << "    state_type xs, dx;\n"
+        << "    std::copy( x , x + xs.size() , xs.begin() );\n"
+        << "    IFF_concat::system_on on( gam );\n"
+        << "    IFF_concat::system_off off( gam );\n"
+        << "    if( stimulated )\n"
+        << "        on( xs , dx , 0.0 );\n"
+        << "    else\n"
+        << "        off( xs , dx , 0.0 );\n"
+        << "    std::copy( dx.begin() , dx.end() , dxdt );\n"
+        << "}\n"
+        << "double model_adaint( double T , double Amax , const double *p0 , size_t n , const double *x0 , const adaint_options *opt )\n"
+        << "{\n"
+        << "    state_type x;\n"
+        << "    std::copy( x0 , x0 + x.size() , x.begin() );\n"
+        << "    return adaint< IFF_concat >( T , Amax , vector<double>( p0 , p0 + n ) , x , *opt );\n"
+        << "}\n"
+        << "double model_adaint_recovery( double *result , double T , double Amax , const double *p0 , size_t n , const double *x0 , const adaint_options *opt , int print , const char *fnm , int recovery_true )\n"
+        << "{\n"
+        << "    state_type x;\n"
+        << "    std::copy( x0 , x0 + x.size() , x.begin() );\n"
+        << "    vector<double> r( 2 );\n"
+        << "    double ht = adaint_recovery< IFF_concat >( r , T , Amax , vector<double>( p0 , p0 + n ) , x , *opt , print , fnm , recovery_true );\n"
+        << "    result[0] = r[0];\n"
+        << "    result[1] = r[1];\n"
+        << "    return ht;\n"
+        << "}\n"
+        << "void model_compute( model_run *run , double T , double Amax , const double *p0 , size_t n , const double *x0 , const adaint_options *opt , int recovery_true )\n"
+        << "{\n"
+        << "    state_type x;\n"
+        << "    std::copy( x0 , x0 + x.size() , x.begin() );\n"
+        << "    habituation_data< state_type > *data = new habituation_data< state_type >();\n"
+        << "    vector<double> r( 2 , -1.0 );\n"
+        << "    run->ht = adaint_recovery_trajectory< IFF_concat >( *data , r , T , Amax , vector<double>( p0 , p0 + n ) , x , *opt , recovery_true );\n"
+        << "    run->rt = r[1];\n"
+        << "    run->n_samples = data->x_vec.size();\n"
+        << "    run->dim = x.size();\n"
+        << "    run->n_peaks = data->peaks_level.size();\n"
+        << "    run->times = data->times.data();\n"
+        << "    run->states = data->x_vec.empty() ? 0 : data->x_vec[0].data();\n"
+        << "    run->peaks_time = data->peaks_time.data();\n"
+        << "    run->peaks_level = data->peaks_level.data();\n"
+        << "    run->owner = data;\n"
+        << "}\n"
+        << "void model_release( model_run *run )\n"
+        << "{\n"
+        << "    delete (habituation_data< state_type >*) run->owner;\n"
+        << "    run->owner = 0;\n"
+        << "}\n"
+        << "void model_adaint_recovery_thresholds( double *ht , double *rt , double T , double Amax , const double *p0 , size_t n , const double *x0 , const adaint_options *opt ,\n"
+        << "                                       const double *ht_thresholds , size_t n_ht , const double *recovery_thresholds , size_t n_recovery , int recovery_true )\n"
+        << "{\n"
+        << "    state_type x;\n"
+        << "    std::copy( x0 , x0 + x.size() , x.begin() );\n"
+        << "    threshold_times res;\n"
+        << "    adaint_recovery_thresholds< IFF_concat >( res , T , Amax , vector<double>( p0 , p0 + n ) , x , *opt ,\n"
+        << "                                              vector<double>( ht_thresholds , ht_thresholds + n_ht ) , vector<double>( recovery_thresholds , recovery_thresholds + n_recovery ) , recovery_true );\n"
+        << "    std::copy( res.ht.begin() , res.ht.end() , ht );\n"
+        << "    std::copy( res.rt.begin() , res.rt.end() , rt );\n"
+        << "}\n"
+        << "size_t model_recovery_envelope( double *rest_times , double *peaks , size_t max_probes , double T , double Amax , const double *p0 , size_t n , const double *x0 , const adaint_options *opt , double tolerance )\n"
+        << "{\n"
+        << "    state_type x;\n"
+        << "    std::copy( x0 , x0 + x.size() , x.begin() );\n"
+        << "    vector<double> tau, y;\n"
+        << "    if( !recovery_envelope< IFF_concat >( tau , y , T , Amax , vector<double>( p0 , p0 + n ) , x , *opt , tolerance , max_probes ) )\n"
+        << "        return 0;\n"
+        << "    size_t n_samples = min( tau.size() , max_probes );\n"
+        << "    std::copy( tau.begin() , tau.begin() + n_samples , rest_times );\n"
+        << "    std::copy( y.begin() , y.begin() + n_samples , peaks );\n"
+        << "    return n_samples;\n"
+        << "}\n"
+        << "double model_screened_adaint_recovery( double *result , double T , double Amax , const double *p0 , size_t n , const double *x0 , const adaint_options *opt , int recovery_true , int *verified )\n"
+        << "{\n"
+        << "    state_type x;\n"
+        << "    std::copy( x0 , x0 + x.size() , x.begin() );\n"
+        << "    vector<double> r( 2 , -1.0 );\n"
+        << "    double ht = screened_adaint_recovery< IFF_concat >( r , T , Amax , vector<double>( p0 , p0 + n ) , x , *opt , recovery_true , verified );\n"
+        << "    result[0] = r[0];\n"
+        << "    result[1] = r[1];\n"
+        << "    return ht;\n"
+        << "}\n"
+        << "}\n";
+    return src.str();
+}
+
+
+inline bool run_command( const string &command , const string &log )
+{
+    string redirected = command + " > '" + log + "' 2>&1";
+    if( system( redirected.c_str() ) != 0 )
+    {
+        cerr << "load_model: '" << command << "' failed, see " << log << endl;
+        return false;
+    }
+    return true;
+}
+
+
+// ------------------------------------
+// Loads the model of source into m, building it first if it is not in
+// the cache. source is a system header (used as it is) or a .py/.ipynb
+// file with the python function `function`, translated by
+// model_compiler.py. Returns false (with a message on cerr) on failure.
+// ------------------------------------
+inline bool load_model( runtime_model &m , const string &source , const string &function , const model_build_options &bopt = model_build_options() )
+{
+    string key;
+    if( !model_cache_key( key , source , function , bopt ) )
+        return false;
+    string base = absolute_path( bopt.cache_dir ) + "/" + key;
+    string so = base + ".so";
+    if( file_exists( so ) )
+        return m.open( so );
+
+    mkdir( bopt.cache_dir.c_str() , 0755 );
+    // generate and build under private names and rename the library, so
+    // that concurrent runs never read a header being written or dlopen
+    // a partial library
+    ostringstream tmp;
+    tmp << base << ".tmp" << getpid();
+    string log = tmp.str() + ".log";
+    string header = absolute_path( source );
+    bool is_header = source.size() > 2 && source.compare( source.size()-2 , 2 , ".h" ) == 0;
+    if( !is_header )
+    {
+        header = tmp.str() + ".h";
+        ostringstream command;
+        command << bopt.python << " '" << absolute_path( ENGINE_DIR ) << "/model_compiler.py' '" << source << "' '" << function
+                << "' -o '" << header << "' --output " << bopt.output;
+        if( bopt.stiff )
+            command << " --stiff";
+        if( !bopt.fast.empty() )
+            command << " --fast '" << bopt.fast << "'";
+        if( !run_command( command.str() , log ) )
+        {
+            remove( header.c_str() );
+            return false;
+        }
+    }
+
+    string cpp = tmp.str() + ".cpp";
+    string tmp_so = tmp.str() + ".so";
+    {
+        ofstream out( cpp.c_str() );
+        out << model_wrapper_source( header );
+    }
+    ostringstream command;
+    command << bopt.compiler << " " << bopt.flags << " -shared -fPIC -o '" << tmp_so << "' '" << cpp << "'";
+    bool ok = run_command( command.str() , log );
+    remove( cpp.c_str() );
+    if( !is_header )
+        ok = ok && (rename( header.c_str() , (base + ".h").c_str() ) == 0);
+    ok = ok && (rename( tmp_so.c_str() , so.c_str() ) == 0);
+    if( !ok )
+    {
+        remove( tmp_so.c_str() );
+        if( !is_header )
+            remove( header.c_str() );
+        return false;
+    }
+    remove( log.c_str() );
+    return m.open( so );
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Calls f(i) for i = 0..n-1 on n_threads threads (0: one per core).
+// Indices are handed out one at a time, so long and short runs mix.
+// ------------------------------------
+template< class Function >
+void parallel_for( size_t n , Function f , unsigned n_threads = 0 )
+{
+    if( n_threads == 0 )
+        n_threads = max( 1u , std::thread::hardware_concurrency() );
+    n_threads = (unsigned) min( (size_t) n_threads , n );
+
+    std::atomic< size_t > next( 0 );
+    auto work = [&]() {
+        for( size_t i = next++ ; i < n ; i = next++ )
+            f( i );
+    };
+    vector< std::thread > threads;
+    for( unsigned k=1 ; k<n_threads ; ++k )
+        threads.push_back( std::thread( work ) );
+    work();
+    for( size_t k=0 ; k<threads.size() ; ++k )
+        threads[k].join();
+}
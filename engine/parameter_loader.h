@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Read-only memory map of a whole file
+// ------------------------------------
+class mapped_file
+{
+    const char *m_data;
+    size_t m_size;
+
+    mapped_file( const mapped_file& );
+    mapped_file& operator=( const mapped_file& );
+
+public:
+    mapped_file() : m_data( 0 ) , m_size( 0 ) { }
+    ~mapped_file() { close(); }
+
+    bool open( const string &fnm )
+    {
+        close();
+        int fd = ::open( fnm.c_str() , O_RDONLY );
+        if( fd < 0 )
+        {
+            cerr << "mapped_file: cannot read " << fnm << endl;
+            return false;
+        }
+        struct stat st;
+        bool ok = (fstat( fd , &st ) == 0);
+        m_size = ok ? size_t( st.st_size ) : 0;
+        if( ok && (m_size > 0) )
+        {
+            void *p = mmap( 0 , m_size , PROT_READ , MAP_PRIVATE , fd , 0 );
+            ok = (p != MAP_FAILED);
+            if( ok )
+            {
+                madvise( p , m_size , MADV_SEQUENTIAL );
+                m_data = (const char*) p;
+            }
+        }
+        ::close( fd );
+        if( !ok )
+        {
+            cerr << "mapped_file: cannot map " << fnm << endl;
+            m_size = 0;
+        }
+        return ok;
+    }
+
+    void close()
+    {
+        if( m_data )
+            munmap( (void*) m_data , m_size );
+        m_data = 0;
+        m_size = 0;
+    }
+
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+};
+
+
+// ------------------------------------
+// Parameter sets, one row per set (row-major, the layout of
+// batch_input::params)
+// ------------------------------------
+struct parameter_table
+{
+    size_t n_columns;
+    vector< string > names;     // column names of the header (empty without header)
+    vector< double > values;
+
+    parameter_table() : n_columns( 0 ) { }
+
+    size_t rows() const { return n_columns ? values.size()/n_columns : 0; }
+    const double* row( size_t i ) const { return values.data() + i*n_columns; }
+    vector< double > row_vector( size_t i ) const { return vector< double >( row( i ) , row( i ) + n_columns ); }
+};
+
+
+// fields are separated by any run of spaces, tabs, commas or semicolons
+inline bool parameter_separator( char c )
+{
+    return (c == ' ') || (c == '\t') || (c == ',') || (c == ';') || (c == '\r');
+}
+
+
+// splits [begin, end) into fields, returns their number
+inline size_t split_fields( const char *begin , const char *end , vector< pair< const char* , const char* > > &fields )
+{
+    fields.clear();
+    const char *p = begin;
+    while( p < end )
+    {
+        while( (p < end) && parameter_separator( *p ) )
+            ++p;
+        if( p == end )
+            break;
+        const char *q = p;
+        while( (q < end) && !parameter_separator( *q ) )
+            ++q;
+        fields.push_back( make_pair( p , q ) );
+        p = q;
+    }
+    return fields.size();
+}
+
+
+inline bool parse_double( const char *begin , const char *end , double &v )
+{
+    if( (begin < end) && (*begin == '+') )
+        ++begin;
+    from_chars_result r = from_chars( begin , end , v );
+    return (r.ec == errc()) && (r.ptr == end);
+}
+
+
+// ------------------------------------
+// CSV, TSV or whitespace separated parameter sets (the system_single.txt
+// files of sensitivity_*), memory mapped and parsed with from_chars.
+// Lines starting with # and empty lines are skipped. A first line that
+// does not start with a number is a header: with names given, the
+// columns are picked by name (in the order of names, other columns are
+// ignored), otherwise the header names the columns. Every row must have
+// n_columns values (names.size() if names are given). Returns false,
+// with the file and line on cerr, on the first malformed row.
+// ------------------------------------
+inline bool load_parameters( parameter_table &table , const string &fnm , size_t n_columns , const vector< string > &names = vector< string >() )
+{
+    if( !names.empty() )
+        n_columns = names.size();
+    table.n_columns = n_columns;
+    table.names.clear();
+    table.values.clear();
+
+    mapped_file file;
+    if( !file.open( fnm ) )
+        return false;
+
+    const char *p = file.begin() , *end = file.end();
+    size_t n_lines = 0;
+    for( const char *q = p ; (q = (const char*) memchr( q , '\n' , end-q )) != 0 ; ++q )
+        ++n_lines;
+    table.values.reserve( (n_lines+1)*n_columns );
+
+    vector< pair< const char* , const char* > > fields;
+    vector< size_t > columns;           // field of each column, picked by name
+    size_t row_fields = n_columns;
+    size_t line = 0;
+    bool first = true;
+    double v;
+    while( p < end )
+    {
+        const char *eol = (const char*) memchr( p , '\n' , end-p );
+        if( !eol )
+            eol = end;
+        ++line;
+        size_t n = split_fields( p , eol , fields );
+        p = eol + 1;
+        if( (n == 0) || (*fields[0].first == '#') )
+            continue;
+
+        if( first )
+        {
+            first = false;
+            if( !parse_double( fields[0].first , fields[0].second , v ) )
+            {
+                vector< string > header;
+                for( size_t j=0 ; j<n ; ++j )
+                    header.push_back( string( fields[j].first , fields[j].second ) );
+                if( names.empty() )
+                {
+                    if( n != n_columns )
+                    {
+                        cerr << "load_parameters: " << fnm << ":" << line << ": header has " << n << " columns, expected " << n_columns << endl;
+                        return false;
+                    }
+                    table.names = header;
+                    continue;
+                }
+                for( size_t k=0 ; k<names.size() ; ++k )
+                {
+                    size_t j = find( header.begin() , header.end() , names[k] ) - header.begin();
+                    if( j == header.size() )
+                    {
+                        cerr << "load_parameters: " << fnm << ": no column " << names[k] << endl;
+                        return false;
+                    }
+                    columns.push_back( j );
+                }
+                table.names = names;
+                row_fields = header.size();
+                continue;
+            }
+        }
+
+        if( n != row_fields )
+        {
+            cerr << "load_parameters: " << fnm << ":" << line << ": " << n << " values, expected " << row_fields << endl;
+            return false;
+        }
+        for( size_t k=0 ; k<n_columns ; ++k )
+        {
+            size_t j = columns.empty() ? k : columns[k];
+            if( !parse_double( fields[j].first , fields[j].second , v ) )
+            {
+                cerr << "load_parameters: " << fnm << ":" << line << ": not a number: " << string( fields[j].first , fields[j].second ) << endl;
+                return false;
+            }
+            table.values.push_back( v );
+        }
+    }
+    return true;
+}
+
+
+
+// parameter sets p0 of Model, validated against Model::n_parameters
+// (which counts Amax)
+template< class Model >
+bool load_model_parameters( parameter_table &table , const string &fnm , const vector< string > &names = vector< string >() )
+{
+    if( !names.empty() && (names.size() != Model::n_parameters-1) )
+    {
+        cerr << "load_model_parameters: " << names.size() << " names for " << Model::n_parameters-1 << " parameters" << endl;
+        return false;
+    }
+    return load_parameters( table , fnm , Model::n_parameters-1 , names );
+}
+
+// ------------------------------------
+// Population dumped by the ESEA runs of evo_search (--printPop, or the
+// eoPop section of a .sav state): optional \section lines and the
+// population size, then one individual per line as
+//     fitness n_genes gene_1 ... gene_n [standard deviations]
+// The genes are the parameter sets, n_genes must equal n_columns; the
+// fitnesses go to fitness if given (nan for INVALID).
+// ------------------------------------
+inline bool load_esea_population( parameter_table &table , const string &fnm , size_t n_columns , vector< double > *fitness = 0 )
+{
+    table.n_columns = n_columns;
+    table.names.clear();
+    table.values.clear();
+    if( fitness )
+        fitness->clear();
+
+    mapped_file file;
+    if( !file.open( fnm ) )
+        return false;
+
+    const char *p = file.begin() , *end = file.end();
+    vector< pair< const char* , const char* > > fields;
+    size_t line = 0;
+    double v;
+    while( p < end )
+    {
+        const char *eol = (const char*) memchr( p , '\n' , end-p );
+        if( !eol )
+            eol = end;
+        ++line;
+        size_t n = split_fields( p , eol , fields );
+        p = eol + 1;
+        // empty lines, \section{...}, the population size
+        if( (n < 2) || (*fields[0].first == '\\') )
+            continue;
+
+        double genes;
+        if( !parse_double( fields[1].first , fields[1].second , genes ) || (genes != double( n_columns )) || (n < 2+n_columns) )
+        {
+            cerr << "load_esea_population: " << fnm << ":" << line << ": expected fitness " << n_columns << " followed by " << n_columns << " genes" << endl;
+            return false;
+        }
+        for( size_t k=0 ; k<n_columns ; ++k )
+        {
+            if( !parse_double( fields[2+k].first , fields[2+k].second , v ) )
+            {
+                cerr << "load_esea_population: " << fnm << ":" << line << ": not a number: " << string( fields[2+k].first , fields[2+k].second ) << endl;
+                return false;
+            }
+            table.values.push_back( v );
+        }
+        if( fitness )
+            fitness->push_back( parse_double( fields[0].first , fields[0].second , v ) ? v : numeric_limits< double >::quiet_NaN() );
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "adaint.h"
+#include "parallel_for.h"
+#include "replay.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// integrate_const of stepper from t0 to t1 (samples every dt into x_vec
+// and times) split into slices integrated in parallel (Parareal):
+//     U_{k+1} = G( U_k ) + F( U_k ) - G( U_k )_previous
+// F is stepper over slice k with its samples, G the same method with
+// the steps its error control takes at tolerance coarse_tol on the
+// first sweep (coarse_grid, integrate_grid of the steppers). Every
+// iteration runs F on the slices whose start is not exact yet on the
+// parallel_for pool, then corrects the starts with the serial G sweep.
+// The first slice not yet exact becomes exact at every iteration, so
+// the loop ends after at most slices iterations; it stops earlier when
+// no start moves by more than tolerance. The slices start on the
+// sampling grid, the samples are those of the serial run up to the
+// restart of the step size control at every slice and tolerance.
+// Returns the number of iterations.
+// ------------------------------------
+template< class System , class Jacobian , class Stepper , class State >
+int parareal_integrate_const( vector< State > &x_vec , vector< double > &times , System sys , Jacobian jac , const Stepper &stepper , const State &x0 , double t0 , double t1 , double dt ,
+                              size_t slices , double tolerance , double coarse_tol = 1E-10 , unsigned n_threads = 0 )
+{
+    size_t n_steps = size_t( (t1 - t0)/dt + 1E-9 );
+    slices = max( size_t( 1 ) , min( slices , n_steps ) );
+    vector< size_t > first( slices+1 );
+    for( size_t k=0 ; k<=slices ; ++k )
+        first[k] = k*n_steps/slices;
+
+    // G: the first sweep is adaptive, later ones take the same steps,
+    // so that G is a smooth function of the slice start
+    vector< vector< double > > grid( slices );
+    auto G = [&]( State y , size_t k ) {
+        stepper.integrate_grid( sys , jac , y , grid[k] );
+        return y;
+    };
+
+    vector< State > U( slices+1 , x0 ) , G_previous( slices , x0 ) , F( slices , x0 );
+    for( size_t k=0 ; k<slices ; ++k )
+    {
+        G_previous[k] = U[k];
+        stepper.coarse_grid( sys , jac , G_previous[k] , t0 + first[k]*dt , t0 + first[k+1]*dt , coarse_tol , grid[k] );
+        U[k+1] = G_previous[k];
+    }
+
+    vector< vector< State > > slice_x( slices );
+    vector< vector< double > > slice_t( slices );
+    size_t exact = 0;                   // slices with an exact start
+    int iterations = 0;
+    while( exact < slices )
+    {
+        ++iterations;
+        parallel_for( slices-exact , [&]( size_t q ) {
+            size_t k = exact + q;
+            vector< State > &xs = slice_x[k];
+            vector< double > &ts = slice_t[k];
+            xs.clear();
+            ts.clear();
+            State y = U[k];
+            stepper.integrate_const( sys , jac , y , t0 + first[k]*dt , t0 + (first[k+1] + 0.5)*dt , dt , [&xs , &ts]( const State &x , double t ) {
+                xs.push_back( x );
+                ts.push_back( t );
+            } );
+            F[k] = y;
+        } , n_threads );
+
+        double change = 0.0;
+        for( size_t k=exact ; k<slices ; ++k )
+        {
+            State g = (k == exact) ? G_previous[k] : G( U[k] , k );
+            State next = F[k];
+            for( size_t i=0 ; i<next.size() ; ++i )
+            {
+                next[i] += g[i] - G_previous[k][i];
+                change = max( change , abs( next[i] - U[k+1][i] ) );
+            }
+            G_previous[k] = g;
+            U[k+1] = next;
+        }
+        ++exact;
+        if( change < tolerance )
+            break;
+    }
+
+    for( size_t k=0 ; k<slices ; ++k )
+    {
+        size_t skip = (k == 0) ? 0 : 1;  // the first sample is the end of the slice before
+        x_vec.insert( x_vec.end() , slice_x[k].begin()+skip , slice_x[k].end() );
+        times.insert( times.end() , slice_t[k].begin()+skip , slice_t[k].end() );
+    }
+    return iterations;
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "adaint_recovery.h"
+#include "forward_sensitivity.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Right-hand side of a model with its variational equation: the state
+// is x followed by the dim columns of V, dV/dt = J(x) V with J the
+// analytic Jacobian of the model (augmented_rhs without source).
+// Integrated over a period from V = I, V is the monodromy matrix of
+// the period map.
+// ------------------------------------
+template< class System , class Jacobian , class ModelState >
+struct variational_rhs
+{
+    System m_f;
+    Jacobian m_jac;
+
+    variational_rhs( vector<double> &full_param ) : m_f( full_param ) , m_jac( full_param ) { }
+
+    void operator()( const vector<double> &X , vector<double> &dXdt , const double t ) const
+    {
+        augmented_rhs< ModelState >( m_f , m_jac , ModelState::static_size , []( size_t , const ModelState& , double , ModelState& ) { } , X , dXdt , t );
+    }
+};
+
+
+// Systems of habituate for the state augmented with V (as
+// sensitivity_systems, explicit stepper only)
+template< class Model >
+struct variational_systems
+{
+    typedef vector< double > state_type;
+    typedef typename Model::state_type model_state_type;
+
+    variational_rhs< typename Model::system_on , typename Model::jacobian_on , model_state_type > on;
+    variational_rhs< typename Model::system_off , typename Model::jacobian_off , model_state_type > off;
+    int jac_on;                 // unused by explicit_stepper
+    int jac_off;
+    size_t output;
+
+    variational_systems( vector<double> &full_param ) : on( full_param ) , off( full_param ) , jac_on( 0 ) , jac_off( 0 ) , output( Model::output ) { }
+
+    model_state_type expand( const state_type &X , bool stimulated ) const
+    {
+        model_state_type x;
+        std::copy( X.begin() , X.begin()+x.size() , x.begin() );
+        return x;
+    }
+
+    double output_value( const state_type &X , bool stimulated ) const { return X[output]; }
+};
+
+
+// ------------------------------------
+// GMRES for A y = b, A given by its products apply( v , Av ), starting
+// from y = 0, until |A y - b| < tolerance, at most b.size() iterations.
+// A singular but consistent system (a conserved quantity of the model
+// gives a multiplier 1) ends at a solution without component along
+// the null space, as long as tolerance stays above the round-off of
+// the products. Returns |A y - b|.
+// ------------------------------------
+template< class Apply >
+double gmres( vector<double> &y , const vector<double> &b , Apply apply , double tolerance )
+{
+    size_t n = b.size();
+    y.assign( n , 0.0 );
+    double beta = 0.0;
+    for( size_t i=0 ; i<n ; ++i )
+        beta += b[i]*b[i];
+    beta = sqrt( beta );
+    if( beta == 0.0 )
+        return 0.0;
+
+    vector< vector<double> > Q( 1 , b );
+    for( size_t i=0 ; i<n ; ++i )
+        Q[0][i] /= beta;
+    vector< vector<double> > H;             // columns of the Hessenberg matrix, rotated to R
+    vector<double> cs , sn , g( 1 , beta );
+    double residual = beta;
+    vector<double> w( n );
+
+    for( size_t k=0 ; k<n ; ++k )
+    {
+        apply( Q[k] , w );
+        double w_norm = 0.0;
+        for( size_t i=0 ; i<n ; ++i )
+            w_norm += w[i]*w[i];
+        w_norm = sqrt( w_norm );
+        vector<double> h( k+2 , 0.0 );
+        for( size_t j=0 ; j<=k ; ++j )
+        {
+            for( size_t i=0 ; i<n ; ++i )
+                h[j] += Q[j][i]*w[i];
+            for( size_t i=0 ; i<n ; ++i )
+                w[i] -= h[j]*Q[j][i];
+        }
+        double norm = 0.0;
+        for( size_t i=0 ; i<n ; ++i )
+            norm += w[i]*w[i];
+        h[k+1] = sqrt( norm );
+
+        for( size_t j=0 ; j<k ; ++j )
+        {
+            double a = cs[j]*h[j] + sn[j]*h[j+1];
+            h[j+1] = -sn[j]*h[j] + cs[j]*h[j+1];
+            h[j] = a;
+        }
+        double r = hypot( h[k] , h[k+1] );
+        cs.push_back( (r > 0.0) ? h[k]/r : 1.0 );
+        sn.push_back( (r > 0.0) ? h[k+1]/r : 0.0 );
+        h[k] = r;
+        g.push_back( -sn[k]*g[k] );
+        g[k] *= cs[k];
+        H.push_back( h );
+        residual = abs( g[k+1] );
+
+        // happy breakdown: the Krylov space is invariant (up to round-off)
+        bool breakdown = (h[k+1] <= 1E-12*w_norm) || (r == 0.0);
+        if( (residual < tolerance) || breakdown || (k+1 == n) )
+            break;
+        Q.push_back( w );
+        for( size_t i=0 ; i<n ; ++i )
+            Q[k+1][i] /= h[k+1];
+    }
+
+    size_t m = H.size();
+    double h_max = 0.0;
+    for( size_t j=0 ; j<m ; ++j )
+        h_max = max( h_max , abs( H[j][j] ) );
+    vector<double> z( m , 0.0 );
+    for( size_t j=m ; j-- > 0 ; )
+    {
+        if( abs( H[j][j] ) <= 1E-12*h_max )
+            continue;               // singular direction, left out
+        double v = g[j];
+        for( size_t l=j+1 ; l<m ; ++l )
+            v -= H[l][j]*z[l];
+        z[j] = v/H[j][j];
+    }
+    for( size_t j=0 ; j<m ; ++j )
+        for( size_t i=0 ; i<n ; ++i )
+            y[i] += z[j]*Q[j][i];
+    return residual;
+}
+
+
+// ------------------------------------
+// Eigenvalues of a small real matrix (row-major, n x n) by the shifted
+// QR algorithm (complex Wilkinson shifts, Givens rotations, deflation
+// of the last row), sorted by decreasing modulus
+// ------------------------------------
+inline vector< complex<double> > eigenvalues( const vector<double> &M , size_t n )
+{
+    typedef complex<double> cd;
+    vector< vector<cd> > A( n , vector<cd>( n ) );
+    double scale = 0.0;
+    for( size_t i=0 ; i<n ; ++i )
+        for( size_t j=0 ; j<n ; ++j )
+        {
+            A[i][j] = M[i*n + j];
+            scale = max( scale , abs( M[i*n + j] ) );
+        }
+
+    vector< cd > lambda( n );
+    vector< double > c( n*n );
+    vector< cd > s( n*n );
+    for( size_t m=n ; m>1 ; --m )
+    {
+        for( int iter=0 ; iter<200 ; ++iter )
+        {
+            double off = 0.0;
+            for( size_t j=0 ; j+1<m ; ++j )
+                off += abs( A[m-1][j] );
+            if( off <= 1E-15*(abs( A[m-1][m-1] ) + scale) )
+                break;
+
+            cd a = A[m-2][m-2] , b = A[m-2][m-1] , cc = A[m-1][m-2] , d = A[m-1][m-1];
+            cd disc = sqrt( (a-d)*(a-d)/4.0 + b*cc );
+            cd mu1 = (a+d)/2.0 + disc , mu2 = (a+d)/2.0 - disc;
+            cd mu = (abs( mu1 - d ) < abs( mu2 - d )) ? mu1 : mu2;
+            if( iter % 11 == 10 )
+                mu = d + off;       // exceptional shift
+            for( size_t i=0 ; i<m ; ++i )
+                A[i][i] -= mu;
+
+            // A - mu = Q R, rotations G_(j,i) zeroing A[i][j]
+            size_t r = 0;
+            for( size_t j=0 ; j+1<m ; ++j )
+                for( size_t i=j+1 ; i<m ; ++i , ++r )
+                {
+                    cd x = A[j][j] , y = A[i][j];
+                    double h = hypot( abs( x ) , abs( y ) );
+                    c[r] = (h > 0.0) ? abs( x )/h : 1.0;
+                    s[r] = (h == 0.0) ? cd( 0.0 ) : ((abs( x ) > 0.0) ? (x/abs( x ))*conj( y )/h : cd( 1.0 ));
+                    for( size_t l=0 ; l<m ; ++l )
+                    {
+                        cd u = A[j][l] , v = A[i][l];
+                        A[j][l] = c[r]*u + s[r]*v;
+                        A[i][l] = -conj( s[r] )*u + c[r]*v;
+                    }
+                }
+            // R Q + mu
+            r = 0;
+            for( size_t j=0 ; j+1<m ; ++j )
+                for( size_t i=j+1 ; i<m ; ++i , ++r )
+                    for( size_t l=0 ; l<m ; ++l )
+                    {
+                        cd u = A[l][j] , v = A[l][i];
+                        A[l][j] = c[r]*u + conj( s[r] )*v;
+                        A[l][i] = -s[r]*u + c[r]*v;
+                    }
+            for( size_t i=0 ; i<m ; ++i )
+                A[i][i] += mu;
+        }
+        lambda[m-1] = A[m-1][m-1];
+    }
+    if( n > 0 )
+        lambda[0] = A[0][0];
+    sort( lambda.begin() , lambda.end() , []( const cd &x , const cd &y ) { return abs( x ) > abs( y ); } );
+    return lambda;
+}
+
+
+// Periodic state of the square-wave protocol (the habituated regime)
+template< class State >
+struct periodic_orbit
+{
+    State x;                    // state at the start of the ON phase
+    vector< complex<double> > multipliers;  // eigenvalues of the monodromy matrix, decreasing modulus
+    double peak;                // asymptotic peak of the output
+    double peak_time;           // its time from the start of the period
+    double residual;            // max |P(x) - x|
+    int iterations;             // Newton iterations
+    int periods;                // periods integrated (with and without V)
+};
+
+
+// ------------------------------------
+// One period of the variational systems from x, V = I: P(x) in Px, the
+// monodromy matrix (row-major) in M and the peak of the period.
+// Returns false if the period leaves [min_level, max_level].
+// ------------------------------------
+template< class Model >
+bool period_map( vector<double> &Px , vector<double> &M , double &peak , double &peak_time , const variational_systems< Model > &s , const vector<double> &x , double T , const adaint_options &opt )
+{
+    size_t dim = x.size();
+    adaint_options o = opt;
+    o.checkpoints = 1;
+    explicit_stepper stepper( opt.abs_tol , opt.rel_tol );
+
+    vector<double> X( dim*(dim+1) , 0.0 );
+    std::copy( x.begin() , x.end() , X.begin() );
+    for( size_t c=0 ; c<dim ; ++c )
+        X[(c+1)*dim + c] = 1.0;
+    double t = 0.0;
+    habituation_data< vector<double> > data;
+    if( !stimulation_period( data , s , stepper , X , t , int(opt.ton / opt.step_size) , int((T - opt.ton)/opt.step_size) , o ) )
+        return false;
+
+    Px.assign( X.begin() , X.begin()+dim );
+    M.assign( dim*dim , 0.0 );
+    for( size_t c=0 ; c<dim ; ++c )
+        for( size_t i=0 ; i<dim ; ++i )
+            M[i*dim + c] = X[(c+1)*dim + i];
+    peak = data.peaks_level.back();
+    peak_time = data.peaks_time.back();
+    return true;
+}
+
+
+// ------------------------------------
+// Periodic steady state of the protocol (T, Amax) by shooting: Newton
+// on P(x) - x = 0 for the period map P, starting from x0 after
+// transient periods. Every iteration integrates one period with the
+// variational equation (explicit stepper); the Newton step solves
+// (M - I) dx = x - P(x) by GMRES on the products with the monodromy
+// matrix M, and is halved until the period from x + dx is accepted
+// and max |P(x) - x| decreases. Converged when max |P(x) - x| <
+// tolerance; the multipliers and the peak are those of the period
+// from the last x. Returns false if not converged (orbit then holds
+// the last iterate) or if the first period is rejected.
+// ------------------------------------
+template< class Model >
+bool periodic_steady_state( periodic_orbit< typename Model::state_type > &orbit , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt ,
+                            int transient = 2 , double tolerance = 1E-10 , int max_iterations = 30 )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    variational_systems< Model > s( full_param );
+    size_t dim = x0.size();
+
+    orbit.iterations = 0;
+    orbit.periods = 0;
+    vector<double> x( x0.begin() , x0.end() );
+    if( transient > 0 )
+    {
+        model_systems< Model > m( full_param );
+        adaint_options o = opt;
+        o.checkpoints = 1;
+        habituation_data< typename Model::state_type > data;
+        typename Model::state_type y = x0;
+        double t = 0.0;
+        for( int k=0 ; k<transient ; ++k , ++orbit.periods )
+            if( !stimulation_period( data , m , explicit_stepper( opt.abs_tol , opt.rel_tol ) , y , t , int(opt.ton / opt.step_size) , int((T - opt.ton)/opt.step_size) , o ) )
+                return false;
+        x.assign( y.begin() , y.end() );
+    }
+
+    vector<double> Px , M , dx , trial( dim ) , trial_Px , trial_M;
+    double trial_peak , trial_peak_time;
+    auto residual = [&]( const vector<double> &y , const vector<double> &Py ) {
+        double r = 0.0;
+        for( size_t i=0 ; i<dim ; ++i )
+            r = max( r , abs( Py[i] - y[i] ) );
+        return r;
+    };
+
+    ++orbit.periods;
+    if( !period_map( Px , M , orbit.peak , orbit.peak_time , s , x , T , opt ) )
+        return false;
+    orbit.residual = residual( x , Px );
+    while( (orbit.residual >= tolerance) && (orbit.iterations < max_iterations) )
+    {
+        ++orbit.iterations;
+        vector<double> r( dim );
+        double r_norm = 0.0;
+        for( size_t i=0 ; i<dim ; ++i )
+        {
+            r[i] = x[i] - Px[i];
+            r_norm += r[i]*r[i];
+        }
+        r_norm = sqrt( r_norm );
+        // inexact Newton: the linear residual relative to |r| falls
+        // with |r|, never below the round-off of the period map
+        double forcing = max( min( 1E-3 , r_norm )*r_norm , 1E-3*tolerance );
+        gmres( dx , r , [&]( const vector<double> &v , vector<double> &Av ) {
+            for( size_t i=0 ; i<dim ; ++i )
+            {
+                double a = -v[i];
+                for( size_t k=0 ; k<dim ; ++k )
+                    a += M[i*dim + k]*v[k];
+                Av[i] = a;
+            }
+        } , forcing );
+
+        // halved (down to 1/16) until the period from x + lambda dx is
+        // accepted and the residual decreases, otherwise one period
+        // from x (x = P(x)): the fast modes relax and the next step
+        // starts closer
+        bool accepted = false;
+        double lambda = 1.0;
+        for( int h=0 ; (h<5) && !accepted ; ++h , lambda /= 2 )
+        {
+            for( size_t i=0 ; i<dim ; ++i )
+                trial[i] = x[i] + lambda*dx[i];
+            if( state_out_of_bounds( trial , opt.min_level , opt.max_level ) )
+                continue;
+            ++orbit.periods;
+            if( !period_map( trial_Px , trial_M , trial_peak , trial_peak_time , s , trial , T , opt ) )
+                continue;
+            accepted = residual( trial , trial_Px ) < orbit.residual;
+        }
+        if( !accepted )
+        {
+            trial = Px;
+            ++orbit.periods;
+            if( !period_map( trial_Px , trial_M , trial_peak , trial_peak_time , s , trial , T , opt ) )
+                break;
+        }
+        x = trial;
+        Px.swap( trial_Px );
+        M.swap( trial_M );
+        orbit.peak = trial_peak;
+        orbit.peak_time = trial_peak_time;
+        orbit.residual = residual( x , Px );
+    }
+
+    std::copy( x.begin() , x.end() , orbit.x.begin() );
+    orbit.multipliers = eigenvalues( M , dim );
+    return orbit.residual < tolerance;
+}
+
+
+// ------------------------------------
+// Recovery time from the periodic steady state instead of a
+// habituation run: relax from orbit.x as recovery_time does from
+// recovery_start (the end of a period), the threshold relative to the
+// first peak of the protocol from x0. Returns false if the first
+// period or a test period is rejected.
+// ------------------------------------
+template< class Model >
+bool steady_state_recovery_time( double &rt , const periodic_orbit< typename Model::state_type > &orbit , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > s( full_param );
+    explicit_stepper stepper( opt.abs_tol , opt.rel_tol );
+
+    double first_peak;
+    if( !period_peak( first_peak , s , stepper , x0 , T , opt ) )
+        return false;
+    recovery_response< model_systems< Model > , explicit_stepper > response( s , stepper , T , orbit.x , 0.0 , opt );
+    return response.time( rt , opt.recovery_threshold , first_peak );
+}
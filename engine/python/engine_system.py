@@ -0,0 +1,168 @@
+"""Drop-in replacement of system.System that runs the habituation protocol in the C++ engine.
+
+    import engine_system as system
+    mys = system.System(f_R_NF, p0, X0, output_var_idx=5, steps_per_time=100)
+    ht, rt = mys.compute(T=T, Ton=Ton, Amin=0, Amax=Amax, ht_threshold=0.01, recovery_threshold=0.95)
+    mys.computational_data["trajectory"]
+
+The model function f is translated with model_compiler.py and compiled once into the cache (see ../model_loader.h),
+so it must follow the notebook form f(X, t, S, k1, ..., kn). The engine stops the stimulation with the rule of
+adaint.integrate and computes ht with calc_util.sliding_maxnorm_ht (Options.criterion = python_criterion), as
+system.py; rt is the recovery time of the engine. trajectory, tvec, peaks_time and
+peaks_level are read-only numpy arrays on the engine memory. Recovery and perturbational trajectories are not kept.
+"""
+
+import hashlib
+import inspect
+import os
+import sys
+import textwrap
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", ".."))
+from adaint import default_int_threshold, default_steps_per_time
+
+import habituation_engine
+
+default_cache_dir = os.environ.get("HABITUATION_MODEL_CACHE", os.path.join(os.path.expanduser("~"), ".cache", "habituation_models"))
+
+
+def model_source(f, cache_dir):
+    """Writes the source of f to a file in the cache, returns its name."""
+    source = textwrap.dedent(inspect.getsource(f))
+    os.makedirs(cache_dir, exist_ok=True)
+    digest = hashlib.sha1(source.encode()).hexdigest()[:16]
+    fnm = os.path.join(cache_dir, "%s_%s.py" % (f.__name__, digest))
+    if not os.path.exists(fnm):
+        with open(fnm, "w") as out:
+            out.write(source)
+    return fnm
+
+
+class System:
+    """Same interface as system.System, computations in the C++ engine."""
+
+    def __init__(self, f, parameter_set, X0, output_var_idx=-1,
+                 steps_per_time=default_steps_per_time, hmax=0,
+                 stiff=True, fast="", cache_dir=default_cache_dir):
+        self.f = f
+        self.parameter_set = list(parameter_set)
+        self.X0 = X0
+        self.output_variable = output_var_idx
+
+        self.steps_per_time = steps_per_time
+        self.step_size = 1 / self.steps_per_time
+        self.hmax = hmax  # not used, the engine controls its own steps
+
+        self.model = habituation_engine.Model(model_source(f, cache_dir), f.__name__,
+                                              output=output_var_idx, stiff=stiff, fast=fast, cache_dir=cache_dir)
+        # rosenbrock4 with error control, sampled every step_size like odeint
+        self.options = habituation_engine.Options()
+        self.options.stiff = 1 if stiff else 0
+        self.options.criterion = habituation_engine.python_criterion
+        self.computational_data = {}
+
+    def compute(self, T=None, Ton=None, Amin=0, Amax=None, verbose=0,
+                ht_threshold=default_int_threshold,
+                recovery_threshold=0.95,
+                **kwargs):
+        """Compute habituation and recovery times and trajectories, as system.System.compute."""
+        if T is None or Ton is None or Amax is None:
+            raise ValueError("Please specify T, Ton and Amax.")
+        if Amin != 0:
+            raise ValueError("The engine integrates the OFF phase with S = 0, use system.System for Amin != 0.")
+        self.T, self.Ton, self.Amin, self.Amax = T, Ton, Amin, Amax
+
+        options = self.options
+        options.ton = Ton
+        options.step_size = self.step_size
+        options.int_threshold = ht_threshold
+        options.recovery_threshold = recovery_threshold
+        result = self.model.compute(T, Amax, self.parameter_set, list(self.X0), options, True)
+
+        peaks_level = result["peaks_level"]
+        if verbose > 0:
+            print("peaks level are: ", peaks_level)
+        ht = int(result["ht"])
+
+        self.computational_data = {'trajectory': result["trajectory"],
+                                   'tvec': result["tvec"],
+                                   'parameter_set': [T, Ton, Amin, Amax] + self.parameter_set,
+                                   'peaks_time': result["peaks_time"],
+                                   'peaks_level': peaks_level,
+                                   'habituation_time': ht * T,
+                                   'habituation_time_step': int(ht * T * self.steps_per_time) - 1}
+
+        rt = result["rt"] if (ht > 0 and result["rt"] >= 0) else 0
+        return ht, rt
+
+    def compute_thresholds(self, T=None, Ton=None, Amin=0, Amax=None,
+                           ht_thresholds=(default_int_threshold,), recovery_thresholds=(0.95,)):
+        """ht and rt for several thresholds from one simulation.
+        Returns ht (one per habituation threshold) and rt (len(ht_thresholds) x len(recovery_thresholds)),
+        each entry equal to compute(ht_threshold=..., recovery_threshold=...) (rt: -1 if not computed)."""
+        if T is None or Ton is None or Amax is None:
+            raise ValueError("Please specify T, Ton and Amax.")
+        if Amin != 0:
+            raise ValueError("The engine integrates the OFF phase with S = 0, use system.System for Amin != 0.")
+        options = self.options
+        options.ton = Ton
+        options.step_size = self.step_size
+        return self.model.compute_thresholds(T, Amax, self.parameter_set, list(self.X0),
+                                             [float(h) for h in ht_thresholds], [float(r) for r in recovery_thresholds], options, True)
+
+    def recovery_envelope(self, T=None, Ton=None, Amin=0, Amax=None, ht_threshold=default_int_threshold,
+                          tolerance=0.01, max_probes=200):
+        """Recovery-response curve from one relaxation, instead of one simulation per rest time as in
+        execute_recovery_envelope: rest times and test peaks normalized by the first peak, refined until
+        neighbouring peaks differ by less than tolerance. Recovery times for any threshold follow by
+        interpolation (np.interp(theta, peaks, rest_times)). Empty arrays if the system does not habituate."""
+        if T is None or Ton is None or Amax is None:
+            raise ValueError("Please specify T, Ton and Amax.")
+        if Amin != 0:
+            raise ValueError("The engine integrates the OFF phase with S = 0, use system.System for Amin != 0.")
+        options = self.options
+        options.ton = Ton
+        options.step_size = self.step_size
+        options.int_threshold = ht_threshold
+        return self.model.recovery_envelope(T, Amax, self.parameter_set, list(self.X0), options, tolerance, max_probes)
+
+    def screen(self, T=None, Ton=None, Amin=0, Amax=None, ht_threshold=default_int_threshold, recovery_threshold=0.95):
+        """ht and rt of compute from a cheap screening run (coarse sampling step, loose tolerances), repeated
+        with the options of compute only when ht, rejection or recovery may have gone the other way.
+        Returns (ht, rt, verified); rt may be a coarse sample off that of compute."""
+        if T is None or Ton is None or Amax is None:
+            raise ValueError("Please specify T, Ton and Amax.")
+        if Amin != 0:
+            raise ValueError("The engine integrates the OFF phase with S = 0, use system.System for Amin != 0.")
+        options = self.options
+        options.ton = Ton
+        options.step_size = self.step_size
+        options.int_threshold = ht_threshold
+        options.recovery_threshold = recovery_threshold
+        return self.model.screened(T, Amax, self.parameter_set, list(self.X0), options, True)
+
+    def compute_batch(self, T=None, Ton=None, Amin=0, Amax=None, parameter_sets=None,
+                      ht_threshold=default_int_threshold, recovery_threshold=0.95, threads=0):
+        """Habituation and recovery times of many runs in one call, on all cores.
+        - T, Ton, Amax: scalars or arrays, broadcast against each other and against the rows of parameter_sets.
+        - parameter_sets: (N x P) array, default self.parameter_set for every run.
+        Returns ht and rt arrays (ht: sliding_maxnorm_ht, 60 for rejected runs; rt: -1 if not computed).
+        No trajectories are kept."""
+        if Amin != 0:
+            raise ValueError("The engine integrates the OFF phase with S = 0, use system.System for Amin != 0.")
+        if parameter_sets is None:
+            parameter_sets = [self.parameter_set]
+        parameter_sets = np.atleast_2d(np.asarray(parameter_sets, dtype=float))
+        rows = np.arange(parameter_sets.shape[0])
+        rows, T, Ton, Amax = np.broadcast_arrays(rows, T, Ton, Amax)
+        shape = rows.shape
+
+        options = self.options
+        options.step_size = self.step_size
+        options.int_threshold = ht_threshold
+        options.recovery_threshold = recovery_threshold
+        ht, rt = self.model.compute_batch(parameter_sets[rows.ravel()], T.ravel().astype(float), Amax.ravel().astype(float),
+                                          Ton.ravel().astype(float), np.asarray(self.X0, dtype=float), options, True, threads)
+        return ht.reshape(shape), rt.reshape(shape)
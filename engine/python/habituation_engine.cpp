@@ -0,0 +1,315 @@
+// pybind11 module giving python access to the engine through runtime
+// models (../model_loader.h). Trajectories and peaks are returned as
+// numpy arrays on the memory of the engine, without copies.
+
+#include <memory>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include "../model_loader.h"
+#include "../batch.h"
+#include "../stepper_benchmark.h"
+
+namespace py = pybind11;
+
+
+// keeps the library loaded while runs or arrays refer to it
+struct model_handle
+{
+    runtime_model model;
+};
+
+
+// a finished run, released when the last array using it is gone
+struct run_handle
+{
+    std::shared_ptr< model_handle > model;
+    model_run run;
+
+    run_handle( const std::shared_ptr< model_handle > &m ) : model( m ) { run.owner = 0; }
+    ~run_handle() { if( run.owner ) model->model.release( run ); }
+};
+
+
+template< class Owner >
+py::array_t< double > shared_array( const std::shared_ptr< Owner > &owner , const double *data , std::vector< py::ssize_t > shape )
+{
+    // the capsule holds a reference to the owner of data
+    py::capsule base( new std::shared_ptr< Owner >( owner ) , []( void *p ) { delete static_cast< std::shared_ptr< Owner >* >( p ); } );
+    std::vector< py::ssize_t > strides( shape.size() , sizeof(double) );
+    for( size_t k=shape.size()-1 ; k>0 ; --k )
+        strides[k-1] = strides[k]*shape[k];
+    py::array_t< double > a( shape , strides , data , base );
+    a.attr( "setflags" )( py::arg( "write" ) = false );
+    return a;
+}
+
+
+class engine_model
+{
+    std::shared_ptr< model_handle > m_handle;
+
+public:
+    engine_model( const std::string &source , const std::string &function , int output , bool stiff , const std::string &fast , const std::string &cache_dir )
+    : m_handle( std::make_shared< model_handle >() )
+    {
+        model_build_options bopt;
+        bopt.output = output;
+        bopt.stiff = stiff;
+        bopt.fast = fast;
+        if( !cache_dir.empty() )
+            bopt.cache_dir = cache_dir;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+            ok = load_model( m_handle->model , source , function , bopt );
+        }
+        if( !ok )
+            throw std::runtime_error( "could not load " + function + " from " + source + " (see stderr)" );
+    }
+
+    size_t dim() const { return m_handle->model.dim; }
+    size_t output() const { return m_handle->model.output; }
+    std::vector< std::string > parameter_names() const { return m_handle->model.parameter_names; }
+    std::vector< std::string > variable_names() const { return m_handle->model.variable_names; }
+    std::string library() const { return m_handle->model.library; }
+
+    // adaint_recovery with the trajectory: dict with ht, rt, tvec,
+    // trajectory, peaks_time and peaks_level
+    py::dict compute( double T , double Amax , const std::vector<double> &p0 , const std::vector<double> &x0 , const adaint_options &opt , bool recovery ) const
+    {
+        if( p0.size()+1 != m_handle->model.n_parameters )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.n_parameters-1 ) + " parameters" );
+        if( x0.size() != m_handle->model.dim )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.dim ) + " initial values" );
+
+        std::shared_ptr< run_handle > h = std::make_shared< run_handle >( m_handle );
+        {
+            py::gil_scoped_release release;
+            m_handle->model.compute( h->run , T , Amax , p0 , x0 , opt , recovery );
+        }
+        const model_run &r = h->run;
+        py::dict d;
+        d["ht"] = r.ht;
+        d["rt"] = r.rt;
+        d["tvec"] = shared_array( h , r.times , { py::ssize_t( r.n_samples ) } );
+        d["trajectory"] = shared_array( h , r.states , { py::ssize_t( r.n_samples ) , py::ssize_t( r.dim ) } );
+        d["peaks_time"] = shared_array( h , r.peaks_time , { py::ssize_t( r.n_peaks ) } );
+        d["peaks_level"] = shared_array( h , r.peaks_level , { py::ssize_t( r.n_peaks ) } );
+        return d;
+    }
+
+    // adaint_recovery for every row of params on a thread pool, without
+    // the GIL. T, Amax and ton have one entry per row, x0 is one state
+    // or one per row. Returns (ht, rt) arrays.
+    py::tuple compute_batch( py::array_t< double , py::array::c_style | py::array::forcecast > params ,
+                             py::array_t< double , py::array::c_style | py::array::forcecast > T ,
+                             py::array_t< double , py::array::c_style | py::array::forcecast > Amax ,
+                             py::array_t< double , py::array::c_style | py::array::forcecast > ton ,
+                             py::array_t< double , py::array::c_style | py::array::forcecast > x0 ,
+                             const adaint_options &opt , bool recovery , unsigned threads ) const
+    {
+        const runtime_model &m = m_handle->model;
+        if( (params.ndim() != 2) || (size_t( params.shape(1) )+1 != m.n_parameters) )
+            throw std::invalid_argument( "params must be N x " + std::to_string( m.n_parameters-1 ) );
+        size_t n = params.shape(0);
+        if( (size_t( T.size() ) != n) || (size_t( Amax.size() ) != n) || (size_t( ton.size() ) != n) )
+            throw std::invalid_argument( "T, Amax and Ton need one entry per parameter set" );
+        if( (size_t( x0.size() ) != m.dim) && (size_t( x0.size() ) != n*m.dim) )
+            throw std::invalid_argument( "x0 must have " + std::to_string( m.dim ) + " or N x " + std::to_string( m.dim ) + " entries" );
+
+        batch_input in;
+        in.n = n;
+        in.n_params = params.shape(1);
+        in.params = params.data();
+        in.T = T.data();
+        in.Amax = Amax.data();
+        in.ton = ton.data();
+        in.x0 = x0.data();
+        in.x0_stride = (size_t( x0.size() ) == m.dim) ? 0 : m.dim;
+
+        py::array_t< double > ht( n ) , rt( n );
+        double *ht_data = ht.mutable_data() , *rt_data = rt.mutable_data();
+        {
+            py::gil_scoped_release release;
+            adaint_recovery_batch( in , m.dim , [&]( std::vector<double> &result , double T , double Amax , const std::vector<double> &p0 , const std::vector<double> &x0 , const adaint_options &o ) {
+                return m.adaint_recovery( result , T , Amax , p0 , x0 , o , 0 , "" , recovery );
+            } , opt , ht_data , rt_data , threads );
+        }
+        return py::make_tuple( ht , rt );
+    }
+
+    // adaint_recovery for every habituation threshold and recovery
+    // threshold from one integration (../thresholds.h). Returns ht
+    // (one per habituation threshold) and rt (habituation x recovery).
+    py::tuple compute_thresholds( double T , double Amax , const std::vector<double> &p0 , const std::vector<double> &x0 ,
+                                  const std::vector<double> &ht_thresholds , const std::vector<double> &recovery_thresholds ,
+                                  const adaint_options &opt , bool recovery ) const
+    {
+        if( p0.size()+1 != m_handle->model.n_parameters )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.n_parameters-1 ) + " parameters" );
+        if( x0.size() != m_handle->model.dim )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.dim ) + " initial values" );
+
+        threshold_times res;
+        {
+            py::gil_scoped_release release;
+            m_handle->model.adaint_recovery_thresholds( res , T , Amax , p0 , x0 , opt , ht_thresholds , recovery_thresholds , recovery );
+        }
+        py::array_t< double > ht( res.ht.size() , res.ht.data() );
+        py::array_t< double > rt( { py::ssize_t( res.ht.size() ) , py::ssize_t( res.n_recovery ) } , res.rt.data() );
+        return py::make_tuple( ht , rt );
+    }
+
+    // refined recovery-response curve (../recovery_index.h): rest
+    // times and peaks normalized by the first peak, empty arrays if the
+    // run is rejected or does not habituate
+    py::tuple recovery_envelope( double T , double Amax , const std::vector<double> &p0 , const std::vector<double> &x0 ,
+                                 const adaint_options &opt , double tolerance , size_t max_probes ) const
+    {
+        if( p0.size()+1 != m_handle->model.n_parameters )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.n_parameters-1 ) + " parameters" );
+        if( x0.size() != m_handle->model.dim )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.dim ) + " initial values" );
+
+        std::vector<double> rest_times , peaks;
+        {
+            py::gil_scoped_release release;
+            m_handle->model.recovery_envelope( rest_times , peaks , T , Amax , p0 , x0 , opt , tolerance , max_probes );
+        }
+        return py::make_tuple( py::array_t< double >( rest_times.size() , rest_times.data() ) , py::array_t< double >( peaks.size() , peaks.data() ) );
+    }
+
+    // benchmark_stepper_policies (../stepper_benchmark.h) on the T x Amax
+    // cells: a list of (methods, seconds, ht difference, rt difference,
+    // disagreeing cells), one per combination of methods
+    py::list benchmark_policies( const std::vector<double> &T , const std::vector<double> &Amax , const std::vector<double> &p0 , const std::vector<double> &x0 ,
+                                 const adaint_options &opt , const adaint_options &reference , const std::vector< std::vector<int> > &combinations , bool recovery ) const
+    {
+        if( p0.size()+1 != m_handle->model.n_parameters )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.n_parameters-1 ) + " parameters" );
+        if( x0.size() != m_handle->model.dim )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.dim ) + " initial values" );
+        for( size_t c=0 ; c<combinations.size() ; ++c )
+            if( combinations[c].size() != n_phases )
+                throw std::invalid_argument( "a combination has the on, off, relax and probe methods" );
+
+        const runtime_model &m = m_handle->model;
+        sweep_grid grid;
+        grid.T = T;
+        grid.Amax = Amax;
+        std::vector< policy_benchmark > res;
+        {
+            py::gil_scoped_release release;
+            res = benchmark_stepper_policies( grid , p0 , x0 , [&]( std::vector<double> &result , double T , double Amax , const std::vector<double> &p , const std::vector<double> &x , const adaint_options &o ) {
+                return m.adaint_recovery( result , T , Amax , p , x , o , 0 , "" , recovery );
+            } , opt , reference , combinations );
+        }
+        py::list l;
+        for( size_t c=0 ; c<res.size() ; ++c )
+            l.append( py::make_tuple( std::vector<int>( res[c].methods , res[c].methods + n_phases ) , res[c].seconds , res[c].ht_difference , res[c].rt_difference , res[c].disagreements ) );
+        return l;
+    }
+
+    // screened_adaint_recovery (../screening.h): (ht, rt, verified),
+    // verified true if the run with options was needed
+    py::tuple screened( double T , double Amax , const std::vector<double> &p0 , const std::vector<double> &x0 , const adaint_options &opt , bool recovery ) const
+    {
+        if( p0.size()+1 != m_handle->model.n_parameters )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.n_parameters-1 ) + " parameters" );
+        if( x0.size() != m_handle->model.dim )
+            throw std::invalid_argument( "expected " + std::to_string( m_handle->model.dim ) + " initial values" );
+
+        std::vector<double> result( 2 , -1.0 );
+        int verified = 1;
+        {
+            py::gil_scoped_release release;
+            m_handle->model.screened_adaint_recovery( result , T , Amax , p0 , x0 , opt , recovery , &verified );
+        }
+        return py::make_tuple( result[0] , result[1] , verified != 0 );
+    }
+
+    std::vector<double> rhs( const std::vector<double> &x , const std::vector<double> &full_param , bool stimulated ) const
+    {
+        if( (x.size() != m_handle->model.dim) || (full_param.size() != m_handle->model.n_parameters) )
+            throw std::invalid_argument( "wrong number of variables or parameters" );
+        std::vector<double> dxdt;
+        m_handle->model.rhs( x , dxdt , full_param , stimulated );
+        return dxdt;
+    }
+};
+
+
+PYBIND11_MODULE( habituation_engine , m )
+{
+    m.doc() = "C++ habituation engine (adaint_recovery) for models compiled at runtime";
+
+    py::class_< adaint_options >( m , "Options" )
+        .def( py::init<>() )
+        .def_readwrite( "ton" , &adaint_options::ton )
+        .def_readwrite( "step_size" , &adaint_options::step_size )
+        .def_readwrite( "step_size_big" , &adaint_options::step_size_big )
+        .def_readwrite( "int_threshold" , &adaint_options::int_threshold )
+        .def_readwrite( "recovery_threshold" , &adaint_options::recovery_threshold )
+        .def_readwrite( "max_periods" , &adaint_options::max_periods )
+        .def_readwrite( "recovery_depth" , &adaint_options::recovery_depth )
+        .def_readwrite( "min_level" , &adaint_options::min_level )
+        .def_readwrite( "max_level" , &adaint_options::max_level )
+        .def_readwrite( "abs_tol" , &adaint_options::abs_tol )
+        .def_readwrite( "rel_tol" , &adaint_options::rel_tol )
+        .def_readwrite( "stiff_abs_tol" , &adaint_options::stiff_abs_tol )
+        .def_readwrite( "stiff_rel_tol" , &adaint_options::stiff_rel_tol )
+        .def_readwrite( "stiff" , &adaint_options::stiff )
+        .def_readwrite( "criterion" , &adaint_options::criterion )
+        .def_readwrite( "min_output_level" , &adaint_options::min_output_level )
+        .def_readwrite( "steady_counter_threshold" , &adaint_options::steady_counter_threshold )
+        .def_readwrite( "increasing_counter_threshold" , &adaint_options::increasing_counter_threshold )
+        .def_readwrite( "num_periods_per_expansion" , &adaint_options::num_periods_per_expansion )
+        .def_readwrite( "max_expansion_attempts" , &adaint_options::max_expansion_attempts )
+        .def_readwrite( "print_every" , &adaint_options::print_every )
+        .def_readwrite( "print_periods" , &adaint_options::print_periods )
+        .def_readwrite( "print_recovery" , &adaint_options::print_recovery )
+        .def_readwrite( "checkpoints" , &adaint_options::checkpoints )
+        .def_readwrite( "recovery_slices" , &adaint_options::recovery_slices )
+        .def_readwrite( "parareal_tol" , &adaint_options::parareal_tol )
+        .def_readwrite( "peak_events" , &adaint_options::peak_events )
+        .def_readwrite( "on_method" , &adaint_options::on_method )
+        .def_readwrite( "off_method" , &adaint_options::off_method )
+        .def_readwrite( "relax_method" , &adaint_options::relax_method )
+        .def_readwrite( "probe_method" , &adaint_options::probe_method )
+        .def_readwrite( "rk4_step" , &adaint_options::rk4_step )
+        .def_readwrite( "screening_step" , &adaint_options::screening_step )
+        .def_readwrite( "screening_tol" , &adaint_options::screening_tol )
+        .def_readwrite( "screening_margin" , &adaint_options::screening_margin )
+        .def_readwrite( "screening_band" , &adaint_options::screening_band );
+    m.attr( "two_peak_criterion" ) = int( two_peak_criterion );
+    m.attr( "python_criterion" ) = int( python_criterion );
+    m.attr( "explicit_method" ) = int( explicit_method );
+    m.attr( "stiff_method" ) = int( stiff_method );
+    m.attr( "dopri5_method" ) = int( dopri5_method );
+    m.attr( "rk4_method" ) = int( rk4_method );
+
+    py::class_< engine_model >( m , "Model" )
+        .def( py::init< const std::string& , const std::string& , int , bool , const std::string& , const std::string& >() ,
+              py::arg( "source" ) , py::arg( "function" ) , py::arg( "output" ) = -1 , py::arg( "stiff" ) = false ,
+              py::arg( "fast" ) = "" , py::arg( "cache_dir" ) = "" )
+        .def_property_readonly( "dim" , &engine_model::dim )
+        .def_property_readonly( "output" , &engine_model::output )
+        .def_property_readonly( "parameter_names" , &engine_model::parameter_names )
+        .def_property_readonly( "variable_names" , &engine_model::variable_names )
+        .def_property_readonly( "library" , &engine_model::library )
+        .def( "compute" , &engine_model::compute , py::arg( "T" ) , py::arg( "Amax" ) , py::arg( "p0" ) , py::arg( "x0" ) ,
+              py::arg( "options" ) = adaint_options() , py::arg( "recovery" ) = true )
+        .def( "compute_batch" , &engine_model::compute_batch , py::arg( "params" ) , py::arg( "T" ) , py::arg( "Amax" ) , py::arg( "Ton" ) ,
+              py::arg( "x0" ) , py::arg( "options" ) = adaint_options() , py::arg( "recovery" ) = true , py::arg( "threads" ) = 0 )
+        .def( "compute_thresholds" , &engine_model::compute_thresholds , py::arg( "T" ) , py::arg( "Amax" ) , py::arg( "p0" ) , py::arg( "x0" ) ,
+              py::arg( "ht_thresholds" ) , py::arg( "recovery_thresholds" ) , py::arg( "options" ) = adaint_options() , py::arg( "recovery" ) = true )
+        .def( "recovery_envelope" , &engine_model::recovery_envelope , py::arg( "T" ) , py::arg( "Amax" ) , py::arg( "p0" ) , py::arg( "x0" ) ,
+              py::arg( "options" ) = adaint_options() , py::arg( "tolerance" ) = 0.01 , py::arg( "max_probes" ) = 200 )
+        .def( "benchmark_policies" , &engine_model::benchmark_policies , py::arg( "T" ) , py::arg( "Amax" ) , py::arg( "p0" ) , py::arg( "x0" ) ,
+              py::arg( "options" ) , py::arg( "reference" ) , py::arg( "combinations" ) , py::arg( "recovery" ) = true )
+        .def( "screened" , &engine_model::screened , py::arg( "T" ) , py::arg( "Amax" ) , py::arg( "p0" ) , py::arg( "x0" ) ,
+              py::arg( "options" ) = adaint_options() , py::arg( "recovery" ) = true )
+        .def( "rhs" , &engine_model::rhs , py::arg( "x" ) , py::arg( "full_param" ) , py::arg( "stimulated" ) );
+}
@@ -0,0 +1,79 @@
+"""Reader of the chunked trajectory files (.htraj) written by the engine (store_sink in ../trajectory_sink.h).
+
+    from trajectory_store import TrajectoryStore
+    store = TrajectoryStore("run.recovery.htraj")
+    t, lo, hi = store.overview("x5", points=2000)     # from the chunk summaries only
+    t, x = store.window("x5", 1000.0, 1200.0, points=2000)
+
+The data and the summaries are numpy memmaps, nothing is read before it is used. overview() touches only the
+min/max summary of each chunk, window() only the chunks overlapping the time range, so traces of 1e8 samples can
+be redrawn interactively.
+"""
+
+import struct
+
+import numpy as np
+
+MAGIC = b"HTRAJ01\n"
+HEADER_SIZE = 4096
+
+
+class TrajectoryStore:
+    def __init__(self, fname):
+        with open(fname, "rb") as f:
+            header = f.read(HEADER_SIZE)
+        if header[:8] != MAGIC:
+            raise ValueError("%s is not a trajectory store" % fname)
+        (self.n_samples, self.n_columns, self.chunk_size, self.n_chunks,
+         data_offset, summary_offset) = struct.unpack("<6Q", header[8:56])
+        self.names = header[56:].split(b"\0", 1)[0].decode().split("\n")
+        # chunks[c, j, :] holds chunk_size consecutive samples of column j
+        self.chunks = np.memmap(fname, dtype="<f8", mode="r", offset=data_offset,
+                                shape=(self.n_chunks, self.n_columns, self.chunk_size))
+        # summary[c, j] = (min, max) of column j in chunk c
+        self.summary = np.memmap(fname, dtype="<f8", mode="r", offset=summary_offset,
+                                 shape=(self.n_chunks, self.n_columns, 2))
+
+    def column_index(self, column):
+        return self.names.index(column) if isinstance(column, str) else column
+
+    def column(self, column, start=0, stop=None):
+        """Samples start:stop of a column (copied from the chunks that hold them)."""
+        j = self.column_index(column)
+        stop = self.n_samples if stop is None else min(stop, self.n_samples)
+        if stop <= start:
+            return np.empty(0)
+        c0, c1 = start // self.chunk_size, (stop - 1) // self.chunk_size + 1
+        values = self.chunks[c0:c1, j, :].reshape(-1)
+        return values[start - c0 * self.chunk_size:stop - c0 * self.chunk_size]
+
+    def time(self, start=0, stop=None):
+        return self.column(0, start, stop)
+
+    def overview(self, column, points=2000):
+        """Min/max envelope of a column in at most points bins, from the chunk summaries only.
+        Returns the start time of each bin and the min and max in it."""
+        j = self.column_index(column)
+        group = max(1, -(-self.n_chunks // points))
+        n = -(-self.n_chunks // group)
+        pad = n * group - self.n_chunks
+        lo = np.concatenate([self.summary[:, j, 0], np.full(pad, np.inf)]).reshape(n, group).min(axis=1)
+        hi = np.concatenate([self.summary[:, j, 1], np.full(pad, -np.inf)]).reshape(n, group).max(axis=1)
+        t = self.summary[::group, 0, 0]
+        return np.asarray(t), lo, hi
+
+    def window(self, column, tmin, tmax, points=2000):
+        """Samples of a column with tmin <= t <= tmax, decimated to about points samples. Chunks outside the
+        range are skipped using the time summary."""
+        tlo, thi = self.summary[:, 0, 0], self.summary[:, 0, 1]
+        inside = np.nonzero((thi >= tmin) & (tlo <= tmax))[0]
+        if len(inside) == 0:
+            return np.empty(0), np.empty(0)
+        start = inside[0] * self.chunk_size
+        stop = min((inside[-1] + 1) * self.chunk_size, self.n_samples)
+        t = self.time(start, stop)
+        x = self.column(column, start, stop)
+        keep = (t >= tmin) & (t <= tmax)
+        t, x = t[keep], x[keep]
+        step = max(1, len(t) // points)
+        return t[::step], x[::step]
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+
+#include<boost/array.hpp>
+#include <boost/numeric/odeint.hpp>
+#include <boost/numeric/ublas/lu.hpp>
+#include "reduction.h"
+
+
+using namespace std;
+using namespace boost::numeric::odeint;
+
+
+struct qssa_options
+{
+    double step_size;       // rk4 step of the reduced model
+    double tolerance;       // allowed relative difference of the full and reduced peaks
+    int max_newton;         // Newton iterations per right-hand side call
+    double newton_tol;
+
+    qssa_options() : step_size(0.01), tolerance(0.01), max_newton(10), newton_tol(1E-12) { }
+};
+
+
+// Fixed size matrix for the Newton iterations, so that the right-hand
+// side calls do not allocate
+template< size_t N >
+struct small_matrix
+{
+    boost::array< double , N*N > m_data;
+
+    void clear() { m_data.fill( 0.0 ); }
+    double& operator()( size_t i , size_t j ) { return m_data[i*N+j]; }
+    double operator()( size_t i , size_t j ) const { return m_data[i*N+j]; }
+};
+
+
+// Solves the leading n x n block of A x = b by Gaussian elimination
+// with partial pivoting, the solution overwrites b
+template< size_t N , class Vector >
+bool gauss_solve( small_matrix< N > &A , Vector &b , size_t n )
+{
+    for( size_t k=0 ; k<n ; ++k )
+    {
+        size_t p = k;
+        for( size_t i=k+1 ; i<n ; ++i )
+            if( abs(A(i,k)) > abs(A(p,k)) )
+                p = i;
+        if( A(p,k) == 0.0 )
+            return false;
+        if( p != k )
+        {
+            for( size_t j=0 ; j<n ; ++j )
+                swap( A(k,j) , A(p,j) );
+            swap( b[k] , b[p] );
+        }
+        for( size_t i=k+1 ; i<n ; ++i )
+        {
+            double factor = A(i,k)/A(k,k);
+            for( size_t j=k ; j<n ; ++j )
+                A(i,j) -= factor*A(k,j);
+            b[i] -= factor*b[k];
+        }
+    }
+    for( size_t k=n ; k-- > 0 ; )
+    {
+        for( size_t j=k+1 ; j<n ; ++j )
+            b[k] -= A(k,j)*b[j];
+        b[k] /= A(k,k);
+    }
+    return true;
+}
+
+
+// ------------------------------------
+// Quasi-steady state of the fast variables (Model::fast_variables())
+// for given slow variables: f_fast(z, y) = 0, where one equation per
+// conservation law among the fast variables is replaced by the law.
+// Solved by Newton's method, warm started from the previous solution;
+// for a linear fast subsystem (e.g. the receptor of evo_search/system.h)
+// this is the closed form after one step.
+// ------------------------------------
+template< class Model >
+class fast_subsystem {
+public:
+    typedef typename Model::state_type full_state_type;
+    static const size_t full_dim = full_state_type::static_size;
+    static const size_t n_fast = Model::n_fast;
+
+    vector< size_t > fast;
+    vector< size_t > slow;
+    vector< vector<double> > laws;      // laws with support in the fast variables
+    vector< size_t > replaced;          // row of the fast block replaced by each law
+    vector< double > total;
+    qssa_options m_qopt;
+    mutable vector< double > m_z;       // last solution, used as initial guess
+
+    fast_subsystem( const full_state_type &x0 , const qssa_options &qopt ) : fast( Model::fast_variables() ) , m_qopt( qopt )
+    {
+        for( size_t j=0 ; j<full_dim ; ++j )
+            if( find( fast.begin() , fast.end() , j ) == fast.end() )
+                slow.push_back( j );
+
+        vector< vector<double> > c = Model::conservation_laws();
+        for( size_t i=0 ; i<c.size() ; ++i )
+        {
+            bool inside = true;
+            for( size_t j=0 ; j<full_dim ; ++j )
+                if( (c[i][j] != 0.0) && (find( fast.begin() , fast.end() , j ) == fast.end()) )
+                    inside = false;
+            if( inside )
+                laws.push_back( c[i] );
+        }
+        conservation_laws rref( laws , full_dim , full_dim );
+        laws = rref.c;
+        rref.set_totals( x0 );
+        total = rref.total;
+        for( size_t i=0 ; i<rref.eliminated.size() ; ++i )
+            replaced.push_back( find( fast.begin() , fast.end() , rref.eliminated[i] ) - fast.begin() );
+
+        m_z.resize( n_fast );
+        for( size_t a=0 ; a<n_fast ; ++a )
+            m_z[a] = x0[fast[a]];
+    }
+
+    // Newton matrix: rows of J on the fast block, law rows where replaced
+    template< class Jacobian , class Matrix >
+    void newton_matrix( const Jacobian &J , Matrix &M ) const
+    {
+        for( size_t a=0 ; a<n_fast ; ++a )
+            for( size_t b=0 ; b<n_fast ; ++b )
+                M(a,b) = J(fast[a],fast[b]);
+        for( size_t i=0 ; i<replaced.size() ; ++i )
+            for( size_t b=0 ; b<n_fast ; ++b )
+                M(replaced[i],b) = laws[i][fast[b]];
+    }
+
+    // fills x with the slow variables y and the quasi-steady fast ones,
+    // stops one Newton step after the residual is below newton_tol
+    template< class System , class Jacobian , class Slow >
+    bool solve( const System &sys , const Jacobian &jac , const Slow &y , full_state_type &x ) const
+    {
+        for( size_t a=0 ; a<slow.size() ; ++a )
+            x[slow[a]] = y[a];
+        for( size_t a=0 ; a<n_fast ; ++a )
+            x[fast[a]] = m_z[a];
+
+        full_state_type f, dfdt;
+        boost::array< double , full_dim > r;
+        small_matrix< full_dim > J, M;
+        for( int it=0 ; it<=m_qopt.max_newton ; ++it )
+        {
+            sys( x , f , 0.0 );
+            double residual = 0.0;
+            for( size_t a=0 ; a<n_fast ; ++a )
+                r[a] = -f[fast[a]];
+            for( size_t i=0 ; i<replaced.size() ; ++i )
+            {
+                double value = -total[i];
+                for( size_t j=0 ; j<full_dim ; ++j )
+                    value += laws[i][j]*x[j];
+                r[replaced[i]] = -value;
+            }
+            for( size_t a=0 ; a<n_fast ; ++a )
+                residual = max( residual , abs(r[a]) );
+            if( residual == 0.0 )
+                break;
+            if( it == m_qopt.max_newton )
+                return nan_fast( x );
+
+            jac( x , J , 0.0 , dfdt );
+            newton_matrix( J , M );
+            if( !gauss_solve( M , r , n_fast ) )
+                return nan_fast( x );
+            for( size_t a=0 ; a<n_fast ; ++a )
+                x[fast[a]] += r[a];
+            // one step past newton_tol brings the error to round-off, so
+            // that the adaptive steppers see a smooth right-hand side
+            if( residual <= m_qopt.newton_tol )
+                break;
+        }
+        for( size_t a=0 ; a<n_fast ; ++a )
+            m_z[a] = x[fast[a]];
+        return true;
+    }
+
+    bool nan_fast( full_state_type &x ) const
+    {
+        for( size_t a=0 ; a<n_fast ; ++a )
+            x[fast[a]] = std::numeric_limits<double>::quiet_NaN();
+        return false;
+    }
+};
+
+
+// Right-hand side on the slow variables with the fast ones at steady state
+template< class Model , class System , class Jacobian >
+class qssa_system {
+    System m_sys;
+    Jacobian m_jac;
+    const fast_subsystem< Model > &m_fast;
+public:
+    qssa_system( const System &sys , const Jacobian &jac , const fast_subsystem< Model > &fast ) : m_sys( sys ) , m_jac( jac ) , m_fast( fast ) { }
+
+    template< class State >
+    void operator() (const State &y, State &dydt, const double t) const {
+        typename Model::state_type x, dxdt;
+        m_fast.solve( m_sys , m_jac , y , x );
+        m_sys( x , dxdt , t );
+        for( size_t a=0 ; a<m_fast.slow.size() ; ++a )
+            dydt[a] = dxdt[m_fast.slow[a]];
+    }
+
+    template< class Slow >
+    void expand( const Slow &y , typename Model::state_type &x ) const { m_fast.solve( m_sys , m_jac , y , x ); }
+};
+
+// J = J_ss + J_sz dz/dy, with dz/dy = -M^-1 J_zs from the implicit function theorem
+template< class Model , class System , class Jacobian >
+class qssa_jacobian {
+    System m_sys;
+    Jacobian m_jac;
+    const fast_subsystem< Model > &m_fast;
+public:
+    qssa_jacobian( const System &sys , const Jacobian &jac , const fast_subsystem< Model > &fast ) : m_sys( sys ) , m_jac( jac ) , m_fast( fast ) { }
+
+    template< class State , class Matrix >
+    void operator() (const State &y, Matrix &J, const double t, State &dfdt) const {
+        const size_t full_dim = fast_subsystem< Model >::full_dim;
+        const size_t n_fast = fast_subsystem< Model >::n_fast;
+        const size_t n_slow = m_fast.slow.size();
+
+        typename Model::state_type x;
+        m_fast.solve( m_sys , m_jac , y , x );
+        stiff_vector_type xv( full_dim ) , dfdt_full( full_dim );
+        stiff_matrix_type J_full( full_dim , full_dim ) , M( n_fast , n_fast ) , dz( n_fast , n_slow );
+        std::copy( x.begin() , x.end() , xv.begin() );
+        m_jac( xv , J_full , t , dfdt_full );
+
+        m_fast.newton_matrix( J_full , M );
+        for( size_t a=0 ; a<n_fast ; ++a )
+            for( size_t b=0 ; b<n_slow ; ++b )
+                dz(a,b) = -J_full(m_fast.fast[a],m_fast.slow[b]);
+        for( size_t i=0 ; i<m_fast.replaced.size() ; ++i )
+            for( size_t b=0 ; b<n_slow ; ++b )
+                dz(m_fast.replaced[i],b) = -m_fast.laws[i][m_fast.slow[b]];
+        boost::numeric::ublas::permutation_matrix< size_t > pm( n_fast );
+        boost::numeric::ublas::lu_factorize( M , pm );
+        boost::numeric::ublas::lu_substitute( M , pm , dz );
+
+        for( size_t a=0 ; a<n_slow ; ++a )
+        {
+            for( size_t b=0 ; b<n_slow ; ++b )
+            {
+                double value = J_full(m_fast.slow[a],m_fast.slow[b]);
+                for( size_t k=0 ; k<n_fast ; ++k )
+                    value += J_full(m_fast.slow[a],m_fast.fast[k])*dz(k,b);
+                J(a,b) = value;
+            }
+            dfdt[a] = 0.0;
+        }
+    }
+};
+
+
+// ------------------------------------
+// Systems of Model with the fast variables at quasi-steady state. The
+// state holds the slow variables only.
+// ------------------------------------
+template< class Model >
+struct qssa_systems
+{
+    typedef typename Model::state_type full_state_type;
+    static const size_t full_dim = full_state_type::static_size;
+    typedef boost::array< double , full_dim - Model::n_fast > state_type;
+    typedef qssa_system< Model , typename Model::system_on , typename Model::jacobian_on > on_type;
+    typedef qssa_system< Model , typename Model::system_off , typename Model::jacobian_off > off_type;
+
+    fast_subsystem< Model > fast_on;
+    fast_subsystem< Model > fast_off;
+    on_type on;
+    off_type off;
+    qssa_jacobian< Model , typename Model::system_on , typename Model::jacobian_on > jac_on;
+    qssa_jacobian< Model , typename Model::system_off , typename Model::jacobian_off > jac_off;
+    size_t output;
+
+    qssa_systems( vector<double> &full_param , const full_state_type &x0 , const qssa_options &qopt )
+    : fast_on( x0 , qopt ) , fast_off( x0 , qopt ) ,
+      on( typename Model::system_on( full_param ) , typename Model::jacobian_on( full_param ) , fast_on ) ,
+      off( typename Model::system_off( full_param ) , typename Model::jacobian_off( full_param ) , fast_off ) ,
+      jac_on( typename Model::system_on( full_param ) , typename Model::jacobian_on( full_param ) , fast_on ) ,
+      jac_off( typename Model::system_off( full_param ) , typename Model::jacobian_off( full_param ) , fast_off ) , output( Model::output ) { }
+
+    state_type reduce( const full_state_type &x ) const
+    {
+        state_type y;
+        for( size_t a=0 ; a<fast_on.slow.size() ; ++a )
+            y[a] = x[fast_on.slow[a]];
+        return y;
+    }
+
+    // the fast variables follow the stimulus
+    full_state_type expand( const state_type &y , bool stimulated ) const
+    {
+        full_state_type x;
+        if( stimulated )
+            on.expand( y , x );
+        else
+            off.expand( y , x );
+        return x;
+    }
+
+    double output_value( const state_type &y , bool stimulated ) const { return expand( y , stimulated )[Model::output]; }
+};
+
+
+// rk4 on the reduced model; the algebraic fast variables are only
+// exact up to the Newton tolerance, e.g. -1e-20 instead of 0
+struct qssa_stepper : public explicit_stepper
+{
+    double m_newton_tol;
+
+    qssa_stepper( double abs_tol , double rel_tol , double newton_tol ) : explicit_stepper( abs_tol , rel_tol ) , m_newton_tol( newton_tol ) { }
+
+    double level_slack() const { return m_newton_tol; }
+};
+
+
+inline bool peaks_agree( double full_peak , double qssa_peak , const qssa_options &qopt )
+{
+    return abs(qssa_peak - full_peak) <= qopt.tolerance*abs(full_peak);
+}
+
+
+// n periods of stimulation from x appended to data, peaks as in habituate
+template< class Systems , class Stepper >
+bool stimulate_periods( habituation_data< typename Systems::state_type > &data , const Systems &s , const Stepper &stepper , double T , typename Systems::state_type x , int n , const adaint_options &opt )
+{
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+
+    double t = 0.0;
+    push_back_trajectory< Systems > obs( data , s , false );
+    if( !opt.checkpoints )
+        obs( x , t );
+    for( int i=0 ; i<n ; ++i )
+        if( !stimulation_period( data , s , stepper , x , t , Ton_duration , Toff_duration , opt ) )
+            return false;
+    return true;
+}
+
+
+// ------------------------------------
+// adaint_recovery on the quasi-steady state model, integrated with rk4
+// at qopt.step_size. The first and the last two habituation periods
+// are repeated with the full model; if a peak differs by more than
+// qopt.tolerance (or the reduced model is rejected) the run is
+// repeated with the full model. *valid tells which one was used.
+// The recovery time is computed with the full model and its own
+// stepper from the state of the last but one period: the long
+// relaxation is where the stiff stepper already takes large steps.
+// ------------------------------------
+template< class Model , class FullStepper >
+double adaint_recovery_qssa_systems( const model_systems< Model > &full , const FullStepper &full_stepper , vector<double> &full_param , vector<double> &result , double T , const typename Model::state_type &x0 , const adaint_options &opt , const qssa_options &qopt , int print , const char* fnm , int recovery_true , int *valid )
+{
+    typedef qssa_systems< Model > systems_type;
+    systems_type s( full_param , x0 , qopt );
+
+    adaint_options qssa_opt = opt;
+    qssa_opt.step_size = qopt.step_size;
+    qssa_stepper stepper( opt.abs_tol , opt.rel_tol , qopt.newton_tol );
+    int Ton_duration = int(qssa_opt.ton / qssa_opt.step_size) ;
+    int Toff_duration = int((T - qssa_opt.ton)/qssa_opt.step_size) ;
+
+    habituation_data< typename systems_type::state_type > data;
+    bool ok = habituate( data , s , stepper , T , s.reduce( x0 ) , qssa_opt ) && (data.peaks_level.size() >= 2);
+
+    // validity: first and last two periods of the full model
+    habituation_data< typename Model::state_type > full_data;
+    if( ok )
+    {
+        double first_peak;
+        ok = period_peak( first_peak , full , full_stepper , x0 , T , opt ) && peaks_agree( first_peak , data.peaks_level[0] , qopt );
+        size_t start = habituation_samples( data , T , qssa_opt )-2*(Ton_duration+Toff_duration)-1;
+        typename systems_type::state_type x_start;
+        double t_start;
+        habituation_sample( x_start , t_start , data , s , stepper , start , T , qssa_opt );
+        ok = ok && stimulate_periods( full_data , full , full_stepper , T , s.expand( x_start , false ) , 2 , opt )
+                && peaks_agree( full_data.peaks_level.back() , data.peaks_level.back() , qopt );
+        if( ok )
+            full_data.peaks_level[0] = first_peak;
+    }
+    if( valid )
+        *valid = ok;
+    if( !ok )
+        return adaint_recovery_systems( full , full_stepper , result , T , x0 , opt , print , fnm , recovery_true );
+
+    int ht = (opt.criterion == python_criterion) ? data.sliding_ht + 1 : data.ht;
+    result[0] = ht - 1;
+    if (print)
+        write_habituation( fnm , s , stepper , data , T , qssa_opt );
+
+    // the recovery always relaxes from the end of the full periods
+    adaint_options recovery_opt = opt;
+    recovery_opt.criterion = two_peak_criterion;
+    bool habituated = (opt.criterion == python_criterion) ? (result[0] > 0) : (result[0] < 50);
+    if ((recovery_true) && habituated)
+    {
+        counted_scope timer( recovery_phase );
+        if( !recovery_time( result[1] , full , full_stepper , T , full_data , recovery_opt ) )
+        {
+            count_event( rejection_count );
+            return 60.0;
+        }
+    }
+    else
+    {
+        result[1] = -1;
+    }
+    return (double)(ht-1);
+}
+
+
+template< class Model >
+double adaint_recovery_qssa( vector<double> &result , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt , const qssa_options &qopt , int print , const char* fnm , int recovery_true , int *valid = 0 )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > full( full_param );
+
+    if( use_stiff_stepper< Model >( opt ) )
+        return adaint_recovery_qssa_systems( full , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , full_param , result , T , x0 , opt , qopt , print , fnm , recovery_true , valid );
+    return adaint_recovery_qssa_systems( full , explicit_stepper( opt.abs_tol , opt.rel_tol ) , full_param , result , T , x0 , opt , qopt , print , fnm , recovery_true , valid );
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <vector>
+
+#include "adaint_recovery.h"
+
+
+using namespace std;
+
+
+// value of a query with the interval it is guaranteed to lie in if the
+// recovery response is monotone
+struct recovery_estimate
+{
+    double value;
+    double lower;
+    double upper;
+};
+
+
+// ------------------------------------
+// Recovery-response curve of one habituated run: normalized test peak
+// (peak / first habituation peak) against the rest time, sampled on the
+// relaxation trajectory of recovery_time. refine() probes the rest
+// times until neighbouring samples differ by less than a tolerance;
+// every probe is kept (also those of exact_time), so the envelope and
+// any number of threshold queries come from one relaxation.
+// ------------------------------------
+template< class Systems , class Stepper >
+class recovery_index
+{
+    typedef recovery_response< Systems , Stepper > response_type;
+
+    response_type m_response;
+    double m_first_peak;
+    double m_step;
+
+    double rest_time( int i ) const { return i*m_step; }
+
+public:
+    recovery_index( const Systems &s , const Stepper &stepper , double T , const habituation_data< typename Systems::state_type > &data , const adaint_options &opt )
+    : m_response( s , stepper , T , data , opt ) ,
+      m_first_peak( data.peaks_level[0] ) , m_step( opt.step_size_big ) { }
+
+    // samples of the relaxation (rest times 0, step_size_big, ...)
+    int size() const { return m_response.size(); }
+    double max_rest_time() const { return rest_time( size()-1 ); }
+
+    // probes 0, the end of the relaxation and rest times halving from
+    // there, then bisects every interval whose normalized peaks differ
+    // by more than tolerance, with at most max_probes probes in total.
+    // Returns false if a test period leaves [min_level, max_level].
+    bool refine( double tolerance = 0.01 , size_t max_probes = 200 )
+    {
+        double p;
+        if( !m_response.peak( p , 0 ) )
+            return false;
+        for( int i=size()-1 ; i>0 ; i/=2 )
+            if( !m_response.peak( p , i ) )
+                return false;
+
+        bool refined = true;
+        while( refined && (m_response.m_peaks.size() < max_probes) )
+        {
+            refined = false;
+            vector<int> probes;
+            typename map< int , double >::const_iterator a = m_response.m_peaks.begin() , b = a;
+            for( ++b ; b != m_response.m_peaks.end() ; ++a , ++b )
+                if( (b->first - a->first > 1) && (abs( b->second - a->second )/m_first_peak > tolerance) )
+                    probes.push_back( (a->first + b->first)/2 );
+            for( size_t k=0 ; (k<probes.size()) && (m_response.m_peaks.size() < max_probes) ; ++k )
+            {
+                if( !m_response.peak( p , probes[k] ) )
+                    return false;
+                refined = true;
+            }
+        }
+        return true;
+    }
+
+    // probed rest times and normalized peaks, by increasing rest time
+    void samples( vector<double> &rest_times , vector<double> &peaks ) const
+    {
+        rest_times.clear();
+        peaks.clear();
+        for( typename map< int , double >::const_iterator it = m_response.m_peaks.begin() ; it != m_response.m_peaks.end() ; ++it )
+        {
+            rest_times.push_back( rest_time( it->first ) );
+            peaks.push_back( it->second/m_first_peak );
+        }
+    }
+
+    // normalized peak after a rest of tau, linear between the probes
+    recovery_estimate peak( double tau ) const
+    {
+        const map< int , double > &peaks = m_response.m_peaks;
+        double f = min( max( tau/m_step , 0.0 ) , double( size()-1 ) );
+        typename map< int , double >::const_iterator b = peaks.lower_bound( int( ceil( f ) ) );
+        if( b == peaks.end() )
+            --b;
+        typename map< int , double >::const_iterator a = b;
+        if( (a != peaks.begin()) && (a->first > f) )
+            --a;
+        double ya = a->second/m_first_peak , yb = b->second/m_first_peak;
+        recovery_estimate e;
+        e.value = (b->first == a->first) ? ya : ya + (yb-ya)*(f - a->first)/(b->first - a->first);
+        e.lower = min( ya , yb );
+        e.upper = max( ya , yb );
+        return e;
+    }
+
+    // rest time after which the normalized peak reaches theta. The value
+    // is interpolated between the probes; recovery_time gives the first
+    // sample in (lower, upper] (exact_time computes it).
+    recovery_estimate time( double theta ) const
+    {
+        const map< int , double > &peaks = m_response.m_peaks;
+        recovery_estimate e;
+        typename map< int , double >::const_iterator b = peaks.begin();
+        while( (b != peaks.end()) && (b->second/m_first_peak < theta) )
+            ++b;
+        if( b == peaks.end() )
+        {
+            // not recovered within the relaxation, as recovery_time
+            e.value = e.lower = e.upper = rest_time( size() );
+            return e;
+        }
+        if( b == peaks.begin() )
+        {
+            e.value = e.lower = e.upper = rest_time( b->first );
+            return e;
+        }
+        typename map< int , double >::const_iterator a = b;
+        --a;
+        double ya = a->second/m_first_peak , yb = b->second/m_first_peak;
+        e.lower = rest_time( a->first + 1 );
+        e.upper = rest_time( b->first );
+        e.value = max( e.lower , rest_time( a->first ) + (theta-ya)/(yb-ya)*(rest_time( b->first ) - rest_time( a->first )) );
+        return e;
+    }
+
+    // recovery_time for threshold theta (the bisection of
+    // adaint_recovery), using and extending the probes
+    bool exact_time( double &rt , double theta )
+    {
+        return m_response.time( rt , theta , m_first_peak );
+    }
+};
+
+
+// ------------------------------------
+// Habituation followed by the refined recovery-response curve (the
+// data of execute_recovery_envelope in paper_figures_all.ipynb).
+// Returns false if the run is rejected or does not habituate.
+// ------------------------------------
+template< class Systems , class Stepper >
+bool recovery_envelope_systems( const Systems &s , const Stepper &stepper , vector<double> &rest_times , vector<double> &peaks , double T , const typename Systems::state_type &x0 , const adaint_options &opt , double tolerance , size_t max_probes )
+{
+    habituation_data< typename Systems::state_type > data;
+    if( !habituate( data , s , stepper , T , x0 , opt ) )
+        return false;
+    bool habituated = (opt.criterion == python_criterion) ? (data.sliding_ht > 0) : (data.ht - 1 < 50);
+    if( !habituated )
+        return false;
+    recovery_index< Systems , Stepper > index( s , stepper , T , data , opt );
+    if( !index.refine( tolerance , max_probes ) )
+        return false;
+    index.samples( rest_times , peaks );
+    return true;
+}
+
+
+template< class Model >
+bool recovery_envelope( vector<double> &rest_times , vector<double> &peaks , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt , double tolerance = 0.01 , size_t max_probes = 200 )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > s( full_param );
+
+    if( phase_methods( opt ) )
+        return recovery_envelope_systems( s , configured_policy< Model >( opt ) , rest_times , peaks , T , x0 , opt , tolerance , max_probes );
+    if( use_stiff_stepper< Model >( opt ) )
+        return recovery_envelope_systems( s , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , rest_times , peaks , T , x0 , opt , tolerance , max_probes );
+    return recovery_envelope_systems( s , explicit_stepper( opt.abs_tol , opt.rel_tol ) , rest_times , peaks , T , x0 , opt , tolerance , max_probes );
+}
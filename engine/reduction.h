@@ -0,0 +1,288 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <random>
+
+#include<boost/array.hpp>
+#include <boost/numeric/odeint.hpp>
+#include "adaint_recovery.h"
+
+
+using namespace std;
+using namespace boost::numeric::odeint;
+
+
+// ------------------------------------
+// Linear conservation laws sum_j c[i][j]*x[j] = total[i], brought to
+// reduced row echelon form so that every law solves for one
+// eliminated variable:
+//     x[eliminated[i]] = total[i] - sum_{j retained} c[i][j]*x[j]
+// ------------------------------------
+struct conservation_laws
+{
+    vector< vector<double> > c;
+    vector< size_t > eliminated;
+    vector< size_t > retained;
+    vector< double > total;
+
+    // the output variable is never eliminated
+    conservation_laws( const vector< vector<double> > &laws , size_t dim , size_t output ) : c( laws )
+    {
+        vector<bool> is_pivot( dim , false );
+        for( size_t i=0 ; i<c.size() ; ++i )
+        {
+            size_t pivot = dim;
+            for( size_t j=0 ; j<dim ; ++j )
+            {
+                if( (j == output) || is_pivot[j] )
+                    continue;
+                if( (pivot == dim) || (abs(c[i][j]) > abs(c[i][pivot])) )
+                    pivot = j;
+            }
+            double norm = c[i][pivot];
+            for( size_t j=0 ; j<dim ; ++j )
+                c[i][j] /= norm;
+            for( size_t k=0 ; k<c.size() ; ++k )
+            {
+                if( k == i )
+                    continue;
+                double factor = c[k][pivot];
+                for( size_t j=0 ; j<dim ; ++j )
+                    c[k][j] -= factor*c[i][j];
+            }
+            is_pivot[pivot] = true;
+            eliminated.push_back( pivot );
+        }
+        for( size_t j=0 ; j<dim ; ++j )
+            if( !is_pivot[j] )
+                retained.push_back( j );
+    }
+
+    template< class State >
+    void set_totals( const State &x0 )
+    {
+        total.assign( c.size() , 0.0 );
+        for( size_t i=0 ; i<c.size() ; ++i )
+            for( size_t j=0 ; j<x0.size() ; ++j )
+                total[i] += c[i][j]*x0[j];
+    }
+
+    template< class Reduced , class State >
+    void reduce( const State &x , Reduced &y ) const
+    {
+        for( size_t a=0 ; a<retained.size() ; ++a )
+            y[a] = x[retained[a]];
+    }
+
+    template< class Reduced , class State >
+    void expand( const Reduced &y , State &x ) const
+    {
+        for( size_t a=0 ; a<retained.size() ; ++a )
+            x[retained[a]] = y[a];
+        for( size_t i=0 ; i<eliminated.size() ; ++i )
+        {
+            double xe = total[i];
+            for( size_t a=0 ; a<retained.size() ; ++a )
+                xe -= c[i][retained[a]]*y[a];
+            x[eliminated[i]] = xe;
+        }
+    }
+};
+
+
+// ------------------------------------
+// Detect the conservation laws shared by both systems from the
+// right-hand sides alone: the vectors c with c.f(x) = 0 at n_samples
+// random states, i.e. the null space of the sampled f.
+// ------------------------------------
+template< class Model >
+vector< vector<double> > detect_conservation_laws( vector<double> &full_param , int n_samples = 20 , double tolerance = 1E-9 )
+{
+    typedef typename Model::state_type state_type;
+    const size_t dim = state_type().size();
+
+    typename Model::system_on sys( full_param );
+    typename Model::system_off sys2( full_param );
+
+    vector< vector<double> > F;
+    double scale = 0.0;
+    std::mt19937 gen( 1 );
+    std::uniform_real_distribution< double > uniform( 0.0 , 1.0 );
+    for( int k=0 ; k<n_samples ; ++k )
+    {
+        state_type x, dxdt, dxdt2;
+        for( size_t j=0 ; j<dim ; ++j )
+            x[j] = uniform( gen );
+        sys( x , dxdt , 0.0 );
+        sys2( x , dxdt2 , 0.0 );
+        F.push_back( vector<double>( dxdt.begin() , dxdt.end() ) );
+        F.push_back( vector<double>( dxdt2.begin() , dxdt2.end() ) );
+        for( size_t j=0 ; j<dim ; ++j )
+            scale = max( scale , max( abs(dxdt[j]) , abs(dxdt2[j]) ) );
+    }
+
+    // Gauss-Jordan elimination with partial pivoting
+    vector< int > pivot_row( dim , -1 );
+    size_t row = 0;
+    for( size_t j=0 ; (j<dim) && (row<F.size()) ; ++j )
+    {
+        size_t best = row;
+        for( size_t i=row ; i<F.size() ; ++i )
+            if( abs(F[i][j]) > abs(F[best][j]) )
+                best = i;
+        if( abs(F[best][j]) <= tolerance*scale )
+            continue;
+        swap( F[row] , F[best] );
+        double norm = F[row][j];
+        for( size_t l=0 ; l<dim ; ++l )
+            F[row][l] /= norm;
+        for( size_t i=0 ; i<F.size() ; ++i )
+        {
+            if( i == row )
+                continue;
+            double factor = F[i][j];
+            for( size_t l=0 ; l<dim ; ++l )
+                F[i][l] -= factor*F[row][l];
+        }
+        pivot_row[j] = row;
+        ++row;
+    }
+
+    // one law per free column
+    vector< vector<double> > laws;
+    for( size_t j=0 ; j<dim ; ++j )
+    {
+        if( pivot_row[j] >= 0 )
+            continue;
+        vector<double> law( dim , 0.0 );
+        law[j] = 1.0;
+        for( size_t l=0 ; l<dim ; ++l )
+            if( (pivot_row[l] >= 0) && (abs(F[pivot_row[l]][j]) > tolerance) )
+                law[l] = -F[pivot_row[l]][j];
+        laws.push_back( law );
+    }
+    return laws;
+}
+
+
+// Right-hand side on the retained variables only
+template< class System , class FullState >
+class reduced_system {
+    System m_sys;
+    const conservation_laws &m_laws;
+public:
+    reduced_system( const System &sys , const conservation_laws &laws ) : m_sys( sys ) , m_laws( laws ) { }
+    template< class State >
+    void operator() (const State &y, State &dydt, const double t) const {
+        FullState x, dxdt;
+        m_laws.expand( y , x );
+        m_sys( x , dxdt , t );
+        m_laws.reduce( dxdt , dydt );
+    }
+};
+
+// J_r = J[r][r] + J[r][e] * dx_e/dx_r, with dx_e/dx_r = -c[e][r]
+template< class Jacobian , class FullState >
+class reduced_jacobian {
+    Jacobian m_jac;
+    const conservation_laws &m_laws;
+public:
+    reduced_jacobian( const Jacobian &jac , const conservation_laws &laws ) : m_jac( jac ) , m_laws( laws ) { }
+    template< class State , class Matrix >
+    void operator() (const State &y, Matrix &J, const double t, State &dfdt) const {
+        const size_t dim = m_laws.retained.size() + m_laws.eliminated.size();
+        stiff_vector_type x( dim ) , dfdt_full( dim );
+        stiff_matrix_type J_full( dim , dim );
+        m_laws.expand( y , x );
+        m_jac( x , J_full , t , dfdt_full );
+        for( size_t a=0 ; a<m_laws.retained.size() ; ++a )
+        {
+            size_t ra = m_laws.retained[a];
+            for( size_t b=0 ; b<m_laws.retained.size() ; ++b )
+            {
+                size_t rb = m_laws.retained[b];
+                double value = J_full(ra,rb);
+                for( size_t i=0 ; i<m_laws.eliminated.size() ; ++i )
+                    value -= J_full(ra,m_laws.eliminated[i])*m_laws.c[i][rb];
+                J(a,b) = value;
+            }
+            dfdt[a] = dfdt_full[ra];
+        }
+    }
+};
+
+
+// ------------------------------------
+// Systems of Model with the conservation laws eliminated. The state
+// has dim - n_conserved variables, expand() gives back the full state
+// for the bounds check and the output files.
+// ------------------------------------
+template< class Model >
+struct reduced_systems
+{
+    typedef typename Model::state_type full_state_type;
+    static const size_t full_dim = full_state_type::static_size;
+    typedef boost::array< double , full_dim - Model::n_conserved > state_type;
+
+    conservation_laws laws;
+    reduced_system< typename Model::system_on , full_state_type > on;
+    reduced_system< typename Model::system_off , full_state_type > off;
+    reduced_jacobian< typename Model::jacobian_on , full_state_type > jac_on;
+    reduced_jacobian< typename Model::jacobian_off , full_state_type > jac_off;
+    size_t output;
+
+    reduced_systems( vector<double> &full_param , const full_state_type &x0 , const vector< vector<double> > &c )
+    : laws( c , full_dim , Model::output ) ,
+      on( typename Model::system_on( full_param ) , laws ) , off( typename Model::system_off( full_param ) , laws ) ,
+      jac_on( typename Model::jacobian_on( full_param ) , laws ) , jac_off( typename Model::jacobian_off( full_param ) , laws )
+    {
+        laws.set_totals( x0 );
+        output = find( laws.retained.begin() , laws.retained.end() , size_t( Model::output ) ) - laws.retained.begin();
+    }
+
+    state_type reduce( const full_state_type &x ) const
+    {
+        state_type y;
+        laws.reduce( x , y );
+        return y;
+    }
+
+    full_state_type expand( const state_type &y , bool stimulated ) const
+    {
+        full_state_type x;
+        laws.expand( y , x );
+        return x;
+    }
+
+    double output_value( const state_type &y , bool stimulated ) const { return y[output]; }
+};
+
+
+// ------------------------------------
+// adaint_recovery integrating the reduced system. Uses the laws
+// declared in the model description, or detects them if the model
+// declares n_conserved laws but does not list them.
+// ------------------------------------
+template< class Model >
+double adaint_recovery_reduced( vector<double> &result , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt , int print , const char* fnm , int recovery_true )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+
+    vector< vector<double> > c = Model::conservation_laws();
+    if( c.size() != Model::n_conserved )
+        c = detect_conservation_laws< Model >( full_param );
+    if( c.size() != Model::n_conserved )
+    {
+        cerr << "adaint_recovery_reduced: found " << c.size() << " conservation laws, the model declares " << Model::n_conserved << endl;
+        return 60.0;
+    }
+
+    reduced_systems< Model > s( full_param , x0 , c );
+    if( phase_methods( opt ) )
+        return adaint_recovery_systems( s , configured_policy< Model >( opt ) , result , T , s.reduce( x0 ) , opt , print , fnm , recovery_true );
+    if( use_stiff_stepper< Model >( opt ) )
+        return adaint_recovery_systems( s , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , result , T , s.reduce( x0 ) , opt , print , fnm , recovery_true );
+    return adaint_recovery_systems( s , explicit_stepper( opt.abs_tol , opt.rel_tol ) , result , T , s.reduce( x0 ) , opt , print , fnm , recovery_true );
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+
+#include "adaint.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Replay of a habituation run with opt.checkpoints, which keeps only
+// the state at the start of every ON and OFF phase. A sample is
+// integrated again from the start of its phase: integrate_n restarts
+// the stepper at every phase, so the replayed samples are the same
+// bits as those of a run keeping the full trajectory.
+// ------------------------------------
+
+struct ignore_samples
+{
+    template< class State >
+    void operator()( const State &x , double t ) const { }
+};
+
+
+// samples of the habituation: x0, then Ton_duration ON and
+// Toff_duration OFF samples per period
+template< class State >
+size_t habituation_samples( const habituation_data< State > &data , double T , const adaint_options &opt )
+{
+    if( !data.times.empty() )
+        return data.times.size();
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+    return 1 + (data.checkpoints.size()/2)*(Ton_duration+Toff_duration);
+}
+
+
+// state and time of sample i, stored or replayed
+template< class Systems , class Stepper >
+void habituation_sample( typename Systems::state_type &x , double &t , const habituation_data< typename Systems::state_type > &data , const Systems &s , const Stepper &stepper , size_t i , double T , const adaint_options &opt )
+{
+    if( !data.x_vec.empty() )
+    {
+        x = data.x_vec[i];
+        t = data.times[i];
+        return;
+    }
+    size_t Ton_duration = size_t(opt.ton / opt.step_size) ;
+    size_t period = Ton_duration + size_t((T - opt.ton)/opt.step_size) ;
+    size_t k = (i == 0) ? 0 : (i-1)/period;
+    size_t r = (i == 0) ? 0 : (i-1)%period + 1;     // steps from the start of period k+1
+    size_t phase = 2*k + ((r >= Ton_duration) ? 1 : 0);
+    if( (r == period) && (phase+1 < data.checkpoints.size()) )
+    {
+        // end of a period, the start of the next one
+        ++phase;
+        r = 0;
+    }
+    x = data.checkpoints[phase];
+    t = data.checkpoint_times[phase];
+    size_t n = (phase % 2) ? r - Ton_duration : r;
+    if( n == 0 )
+        return;
+    if( phase % 2 )
+        off_stepper( stepper ).integrate_n( s.off , s.jac_off , x , t , n , opt.step_size , ignore_samples() );
+    else
+        on_stepper( stepper ).integrate_n( s.on , s.jac_on , x , t , n , opt.step_size , ignore_samples() );
+}
+
+
+template< class Systems >
+struct push_back_window
+{
+    typedef typename Systems::state_type state_type;
+
+    push_back_trajectory< Systems > m_obs;
+    double m_tmin;
+    double m_tmax;
+
+    push_back_window( habituation_data< state_type > &window , const Systems &s , bool stimulated , double tmin , double tmax )
+    : m_obs( window , s , stimulated ) , m_tmin( tmin ) , m_tmax( tmax ) { }
+
+    void operator()( const state_type &x , double t )
+    {
+        if( (t >= m_tmin) && (t <= m_tmax) )
+            m_obs( x , t );
+    }
+};
+
+
+// ------------------------------------
+// Samples of data with tmin <= t <= tmax (and the peaks in that
+// range) appended to window, integrating only the phases overlapping
+// the range. Only the checkpoints of data are used.
+// ------------------------------------
+template< class Systems , class Stepper >
+void replay_window( habituation_data< typename Systems::state_type > &window , const habituation_data< typename Systems::state_type > &data , const Systems &s , const Stepper &stepper , double T , double tmin , double tmax , const adaint_options &opt )
+{
+    typedef typename Systems::state_type state_type;
+
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+
+    size_t n_phases = data.checkpoints.size() - data.checkpoints.size() % 2;
+    if( (n_phases > 0) && (tmin <= data.checkpoint_times[0]) && (data.checkpoint_times[0] <= tmax) )
+    {
+        push_back_trajectory< Systems > obs( window , s , false );
+        obs( data.checkpoints[0] , data.checkpoint_times[0] );
+    }
+    for( size_t phase=0 ; phase<n_phases ; ++phase )
+    {
+        double end = (phase+1 < data.checkpoint_times.size()) ? data.checkpoint_times[phase+1] : numeric_limits< double >::infinity();
+        if( (end < tmin) || (data.checkpoint_times[phase] >= tmax) )
+            continue;
+        state_type x = data.checkpoints[phase];
+        double t = data.checkpoint_times[phase];
+        bool stimulated = (phase % 2 == 0);
+        push_back_window< Systems > obs( window , s , stimulated , tmin , tmax );
+        if( stimulated )
+            on_stepper( stepper ).integrate_n( s.on , s.jac_on , x , t , Ton_duration , opt.step_size , obs );
+        else
+            off_stepper( stepper ).integrate_n( s.off , s.jac_off , x , t , Toff_duration , opt.step_size , obs );
+    }
+    for( size_t k=0 ; k<data.peaks_time.size() ; ++k )
+        if( (data.peaks_time[k] >= tmin) && (data.peaks_time[k] <= tmax) )
+        {
+            window.peaks_time.push_back( data.peaks_time[k] );
+            window.peaks_level.push_back( data.peaks_level[k] );
+        }
+}
+
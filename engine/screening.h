@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "adaint_recovery.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Screening of adaint and adaint_recovery: a cheap run (sampling step
+// opt.screening_step with peak events, tolerances opt.screening_tol,
+// rosenbrock4 for the relaxation unless opt.relax_method says
+// otherwise) whose verdict is kept unless one of its decisions may
+// have gone the other way, in which case the run is repeated with opt:
+//  - a two-peak test within opt.screening_margin*int_threshold of
+//    int_threshold (ht, and with it ht >= 50, only change through them),
+//  - a state within opt.screening_band of min_level or max_level, or
+//    beyond them (a rejection),
+//  - the test peak at the end of the relaxation (recovered or not)
+//    within opt.screening_margin*recovery_threshold of the threshold.
+// The python criterion is not screened.
+// ------------------------------------
+template< class Model >
+struct screening_systems : model_systems< Model >
+{
+    typedef typename Model::state_type state_type;
+
+    double m_min_level;
+    double m_max_level;
+    double m_band;
+    mutable bool m_near_bound;  // a bounds check saw a state in the band
+
+    screening_systems( vector<double> &full_param , const adaint_options &opt ) : model_systems< Model >( full_param ) ,
+        m_min_level( opt.min_level ) , m_max_level( opt.max_level ) , m_band( opt.screening_band ) , m_near_bound( false ) { }
+
+    // called for the bounds checks of the phases
+    const state_type& expand( const state_type &x , bool stimulated ) const
+    {
+        for( size_t i=0 ; i<x.size() ; ++i )
+            if( (x[i] < m_min_level + m_band) || (x[i] > m_max_level - m_band) )
+                m_near_bound = true;
+        return x;
+    }
+};
+
+
+// true if no two-peak test of data is within margin*int_threshold of
+// int_threshold
+template< class State >
+bool convergence_certain( const habituation_data< State > &data , const adaint_options &opt )
+{
+    for( size_t k=1 ; k<data.peaks_level.size() ; ++k )
+        if( abs( abs( 1 - data.peaks_level[k]/data.peaks_level[k-1] ) - opt.int_threshold ) <= opt.screening_margin*opt.int_threshold )
+            return false;
+    return true;
+}
+
+
+// true if a/b < bound holds or fails by more than margin*bound, e.g.
+// the 0.95 ratio tests of real_value on screened ht and rt
+inline bool ratio_certain( double a , double b , double bound , double margin )
+{
+    return abs( a/b - bound ) > margin*bound;
+}
+
+
+// options of the screening run
+inline adaint_options screening_options( const adaint_options &opt )
+{
+    adaint_options o = opt;
+    o.step_size = opt.screening_step;
+    o.peak_events = 1;
+    o.abs_tol = o.rel_tol = opt.screening_tol;
+    o.stiff_abs_tol = o.stiff_rel_tol = opt.screening_tol;
+    if( o.relax_method < 0 )
+        o.relax_method = stiff_method;
+    o.recovery_slices = 0;
+    return o;
+}
+
+
+// habituation of the screening run; false if it has to be verified
+template< class Stepper , class Model >
+bool screen_habituation( habituation_data< typename Model::state_type > &data , const screening_systems< Model > &s , const Stepper &stepper ,
+                         double T , const typename Model::state_type &x0 , const adaint_options &opt )
+{
+    return habituate( data , s , stepper , T , x0 , screening_options( opt ) ) && !s.m_near_bound && convergence_certain( data , opt );
+}
+
+
+// habituation and recovery of the screening run into result; false if
+// they have to be verified
+template< class Stepper , class Model >
+bool screen_recovery( vector<double> &result , const screening_systems< Model > &s , const Stepper &stepper ,
+                      double T , const typename Model::state_type &x0 , const adaint_options &opt , int recovery_true )
+{
+    habituation_data< typename Model::state_type > data;
+    if( !screen_habituation( data , s , stepper , T , x0 , opt ) )
+        return false;
+
+    result[0] = data.ht - 1;
+    result[1] = -1;
+    if( !recovery_true || (result[0] >= 50) )
+        return true;
+    recovery_response< screening_systems< Model > , Stepper > response( s , stepper , T , data , screening_options( opt ) );
+    double last;
+    if( !response.time( result[1] , opt.recovery_threshold , data.peaks_level[0] ) || !response.peak( last , response.size()-1 ) )
+        return false;
+    return !s.m_near_bound && (abs( last/data.peaks_level[0] - opt.recovery_threshold ) > opt.screening_margin*opt.recovery_threshold);
+}
+
+
+// ------------------------------------
+// adaint screened as above. verified, if given, is set to 1 when the
+// run with opt was needed.
+// ------------------------------------
+template< class Model >
+double screened_adaint( double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt = adaint_options() , int *verified = 0 )
+{
+    if( verified )
+        *verified = 1;
+    if( opt.criterion == python_criterion )
+        return adaint< Model >( T , Amax , p0 , x0 , opt );
+
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    screening_systems< Model > s( full_param , opt );
+    habituation_data< typename Model::state_type > data;
+    if( !screen_habituation( data , s , configured_policy< Model >( screening_options( opt ) ) , T , x0 , opt ) )
+        return adaint< Model >( T , Amax , p0 , x0 , opt );
+    if( verified )
+        *verified = 0;
+    return (double)data.ht;
+}
+
+
+// ------------------------------------
+// adaint_recovery (without files) screened as above. The recovery
+// time is that of the screening run, whose crossing of the recovery
+// threshold may be a sample off; tests on it go through ratio_certain.
+// ------------------------------------
+template< class Model >
+double screened_adaint_recovery( vector<double> &result , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 ,
+                                 const adaint_options &opt , int recovery_true , int *verified = 0 )
+{
+    if( verified )
+        *verified = 1;
+    if( opt.criterion == python_criterion )
+        return adaint_recovery< Model >( result , T , Amax , p0 , x0 , opt , 0 , "" , recovery_true );
+
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    screening_systems< Model > s( full_param , opt );
+    vector<double> screened( 2 , -1.0 );
+    if( !screen_recovery( screened , s , configured_policy< Model >( screening_options( opt ) ) , T , x0 , opt , recovery_true ) )
+        return adaint_recovery< Model >( result , T , Amax , p0 , x0 , opt , 0 , "" , recovery_true );
+    result[0] = screened[0];
+    result[1] = screened[1];
+    if( verified )
+        *verified = 0;
+    return screened[0];
+}
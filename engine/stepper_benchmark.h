@@ -0,0 +1,147 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+#include "sweep.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Speed and agreement of the stepper policies (steppers.h) on one
+// parameter set: every combination of the methods of the four phases
+// runs the cells of a sweep_grid one after the other and is compared
+// with a reference run (tight tolerances, small steps).
+// ------------------------------------
+enum { on_phase = 0 , off_phase , relax_phase , probe_phase , n_phases };
+
+
+struct policy_benchmark
+{
+    int methods[n_phases];      // on, off, relax and probe method (-1: that of the run)
+    double seconds;             // wall time of all cells
+    double ht_difference;       // largest |ht - ht_reference|
+    double rt_difference;       // largest |rt - rt_reference|/rt_reference over the cells with a recovery time
+    size_t disagreements;       // cells whose ht or recovery (habituated or not) differ from the reference
+};
+
+
+inline const char* method_name( int method )
+{
+    switch( method )
+    {
+        case explicit_method : return "explicit";
+        case stiff_method : return "stiff";
+        case dopri5_method : return "dopri5";
+        case rk4_method : return "rk4";
+        default : return "run";
+    }
+}
+
+
+// every combination of the methods given for each phase, probe fastest
+inline vector< vector<int> > method_combinations( const vector<int> &on , const vector<int> &off , const vector<int> &relax , const vector<int> &probe )
+{
+    vector< vector<int> > c;
+    for( size_t a=0 ; a<on.size() ; ++a )
+        for( size_t b=0 ; b<off.size() ; ++b )
+            for( size_t r=0 ; r<relax.size() ; ++r )
+                for( size_t q=0 ; q<probe.size() ; ++q )
+                    c.push_back( { on[a] , off[b] , relax[r] , probe[q] } );
+    return c;
+}
+
+
+// ------------------------------------
+// Runs reference and then every combination (opt with its methods) on
+// the cells of grid (opt.ton if grid.ton is empty). run is called as
+// in adaint_recovery_batch. The cells run serially, so the times
+// compare the policies and not the thread pool.
+// ------------------------------------
+template< class Run >
+vector< policy_benchmark > benchmark_stepper_policies( const sweep_grid &grid , const vector<double> &p0 , const vector<double> &x0 , Run run ,
+                                                       const adaint_options &opt , const adaint_options &reference , const vector< vector<int> > &combinations )
+{
+    auto cells = [&]( const adaint_options &o , vector<double> &ht , vector<double> &rt ) {
+        ht.clear();
+        rt.clear();
+        for( size_t i=0 ; i<grid.T.size() ; ++i )
+            for( size_t j=0 ; j<grid.Amax.size() ; ++j )
+                for( size_t k=0 ; k<grid.n_ton() ; ++k )
+                {
+                    adaint_options c = o;
+                    if( !grid.ton.empty() )
+                        c.ton = grid.ton[k];
+                    vector<double> result( 2 , -1.0 );
+                    ht.push_back( run( result , grid.T[i] , grid.Amax[j] , p0 , x0 , c ) );
+                    rt.push_back( result[1] );
+                }
+    };
+
+    vector<double> ht_reference , rt_reference , ht , rt;
+    cells( reference , ht_reference , rt_reference );
+
+    vector< policy_benchmark > res;
+    for( size_t c=0 ; c<combinations.size() ; ++c )
+    {
+        adaint_options o = opt;
+        o.on_method = combinations[c][on_phase];
+        o.off_method = combinations[c][off_phase];
+        o.relax_method = combinations[c][relax_phase];
+        o.probe_method = combinations[c][probe_phase];
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        cells( o , ht , rt );
+        policy_benchmark b;
+        b.seconds = chrono::duration< double >( chrono::steady_clock::now() - start ).count();
+        for( int k=0 ; k<n_phases ; ++k )
+            b.methods[k] = combinations[c][k];
+        b.ht_difference = 0.0;
+        b.rt_difference = 0.0;
+        b.disagreements = 0;
+        for( size_t i=0 ; i<ht.size() ; ++i )
+        {
+            b.ht_difference = max( b.ht_difference , abs( ht[i] - ht_reference[i] ) );
+            bool recovered = (rt[i] > 0.0) , recovered_reference = (rt_reference[i] > 0.0);
+            if( recovered && recovered_reference )
+                b.rt_difference = max( b.rt_difference , abs( rt[i] - rt_reference[i] )/rt_reference[i] );
+            if( (ht[i] != ht_reference[i]) || (recovered != recovered_reference) )
+                ++b.disagreements;
+        }
+        res.push_back( b );
+    }
+    return res;
+}
+
+
+template< class Model >
+vector< policy_benchmark > benchmark_stepper_policies( const sweep_grid &grid , const vector<double> &p0 , const typename Model::state_type &x0 ,
+                                                       const adaint_options &opt , const adaint_options &reference , const vector< vector<int> > &combinations , int recovery_true = 1 )
+{
+    vector<double> x( x0.begin() , x0.end() );
+    return benchmark_stepper_policies( grid , p0 , x ,
+        [&]( vector<double> &result , double T , double Amax , const vector<double> &p , const vector<double> &xv , const adaint_options &o ) {
+            typename Model::state_type s;
+            std::copy( xv.begin() , xv.end() , s.begin() );
+            return adaint_recovery< Model >( result , T , Amax , p , s , o , 0 , "" , recovery_true );
+        } , opt , reference , combinations );
+}
+
+
+// one line per policy, fastest first: the four methods, seconds, ht
+// and rt differences and disagreeing cells
+inline void write_policy_benchmark( ostream &out , vector< policy_benchmark > res )
+{
+    sort( res.begin() , res.end() , []( const policy_benchmark &a , const policy_benchmark &b ) { return a.seconds < b.seconds; } );
+    out << "on\toff\trelax\tprobe\tseconds\tht_diff\trt_diff\tdisagree" << endl;
+    for( size_t c=0 ; c<res.size() ; ++c )
+    {
+        for( int k=0 ; k<n_phases ; ++k )
+            out << method_name( res[c].methods[k] ) << "\t";
+        out << res[c].seconds << "\t" << res[c].ht_difference << "\t" << res[c].rt_difference << "\t" << res[c].disagreements << endl;
+    }
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include<boost/array.hpp>
+#include <boost/numeric/odeint.hpp>
+#include <boost/numeric/ublas/vector.hpp>
+#include <boost/numeric/ublas/matrix.hpp>
+
+
+using namespace std;
+using namespace boost::numeric::odeint;
+
+
+typedef boost::numeric::ublas::vector< double > stiff_vector_type;
+typedef boost::numeric::ublas::matrix< double > stiff_matrix_type;
+
+
+// ------------------------------------
+// Explicit steppers, as in the per-model adaint copies:
+// fixed step runge_kutta4 for the stimulation periods and
+// controlled dopri5 for the recovery relaxation
+// ------------------------------------
+struct explicit_stepper
+{
+    double m_abs_tol;
+    double m_rel_tol;
+
+    explicit_stepper( double abs_tol , double rel_tol ) : m_abs_tol( abs_tol ) , m_rel_tol( rel_tol ) { }
+
+    // allowed excursion outside [min_level, max_level], rk4 keeps the bounds exactly
+    double level_slack() const { return 0.0; }
+
+    // n steps of size dt from t, obs(x, t) is called after every step
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_n( System sys , Jacobian jac , State &x , double &t , size_t n , double dt , Observer obs ) const
+    {
+        runge_kutta4< State > rk4;
+        for( size_t i=0 ; i<n ; ++i )
+        {
+            rk4.do_step( sys , x , t , dt );
+            t += dt;
+            obs( x , t );
+        }
+    }
+
+    // from t0 to t1, obs(x, t) is called at t0 and every dt
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_const( System sys , Jacobian jac , State &x , double t0 , double t1 , double dt , Observer obs ) const
+    {
+        boost::numeric::odeint::integrate_const( make_controlled( m_abs_tol , m_rel_tol , runge_kutta_dopri5< State >() ) , sys , x , t0 , t1 , dt , obs );
+    }
+
+    // controlled dopri5 from t0 to t1 with the tolerances given, the
+    // times of the accepted steps (t0 to t1) into grid
+    template< class System , class Jacobian , class State >
+    void coarse_grid( System sys , Jacobian jac , State &x , double t0 , double t1 , double tol , vector<double> &grid ) const
+    {
+        grid.clear();
+        boost::numeric::odeint::integrate_adaptive( make_controlled( tol , tol , runge_kutta_dopri5< State >() ) , sys , x , t0 , t1 , t1-t0 , [&grid]( const State &y , double t ) { grid.push_back( t ); } );
+    }
+
+    // dopri5 steps along grid, without error control: a smooth function of x
+    template< class System , class Jacobian , class State >
+    void integrate_grid( System sys , Jacobian jac , State &x , const vector<double> &grid ) const
+    {
+        runge_kutta_dopri5< State > dopri5;
+        for( size_t i=1 ; i<grid.size() ; ++i )
+            dopri5.do_step( sys , x , grid[i-1] , grid[i]-grid[i-1] );
+    }
+};
+
+
+// ------------------------------------
+// Linearly implicit rosenbrock4 with dense output, for stiff models.
+// The internal step is chosen by the error control, the observer
+// still sees the same sampling grid as the explicit stepper.
+// ------------------------------------
+struct stiff_stepper
+{
+    double m_abs_tol;
+    double m_rel_tol;
+
+    stiff_stepper( double abs_tol , double rel_tol ) : m_abs_tol( abs_tol ) , m_rel_tol( rel_tol ) { }
+
+    // the dense output overshoots bounds like 0 by round-off (~1e-13)
+    double level_slack() const { return m_abs_tol; }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_n( System sys , Jacobian jac , State &x , double &t , size_t n , double dt , Observer obs ) const
+    {
+        stiff_vector_type xv( x.size() );
+        std::copy( x.begin() , x.end() , xv.begin() );
+
+        rosenbrock4_dense_output< rosenbrock4_controller< rosenbrock4< double > > > stepper = make_dense_output( m_abs_tol , m_rel_tol , rosenbrock4< double >() );
+        stepper.initialize( xv , t , dt );
+        for( size_t i=0 ; i<n ; ++i )
+        {
+            t += dt;
+            while( stepper.current_time() < t )
+                stepper.do_step( std::make_pair( sys , jac ) );
+            stepper.calc_state( t , xv );
+            std::copy( xv.begin() , xv.end() , x.begin() );
+            obs( x , t );
+        }
+    }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_const( System sys , Jacobian jac , State &x , double t0 , double t1 , double dt , Observer obs ) const
+    {
+        stiff_vector_type xv( x.size() );
+        std::copy( x.begin() , x.end() , xv.begin() );
+
+        boost::numeric::odeint::integrate_const( make_dense_output( m_abs_tol , m_rel_tol , rosenbrock4< double >() ) , std::make_pair( sys , jac ) , xv , t0 , t1 , dt , stiff_observer< State , Observer >( obs ) );
+        std::copy( xv.begin() , xv.end() , x.begin() );
+    }
+
+    template< class System , class Jacobian , class State >
+    void coarse_grid( System sys , Jacobian jac , State &x , double t0 , double t1 , double tol , vector<double> &grid ) const
+    {
+        stiff_vector_type xv( x.size() );
+        std::copy( x.begin() , x.end() , xv.begin() );
+        grid.clear();
+        boost::numeric::odeint::integrate_adaptive( make_controlled( tol , tol , rosenbrock4< double >() ) , std::make_pair( sys , jac ) , xv , t0 , t1 , t1-t0 , [&grid]( const stiff_vector_type &y , double t ) { grid.push_back( t ); } );
+        std::copy( xv.begin() , xv.end() , x.begin() );
+    }
+
+    template< class System , class Jacobian , class State >
+    void integrate_grid( System sys , Jacobian jac , State &x , const vector<double> &grid ) const
+    {
+        stiff_vector_type xv( x.size() );
+        std::copy( x.begin() , x.end() , xv.begin() );
+        rosenbrock4< double > stepper;
+        for( size_t i=1 ; i<grid.size() ; ++i )
+            stepper.do_step( std::make_pair( sys , jac ) , xv , grid[i-1] , grid[i]-grid[i-1] );
+        std::copy( xv.begin() , xv.end() , x.begin() );
+    }
+
+    // converts the ublas state back before handing it to the observer
+    template< class State , class Observer >
+    struct stiff_observer
+    {
+        Observer m_obs;
+        stiff_observer( Observer obs ) : m_obs( obs ) { }
+
+        void operator()( const stiff_vector_type &xv , double t )
+        {
+            State x;
+            std::copy( xv.begin() , xv.end() , x.begin() );
+            m_obs( x , t );
+        }
+    };
+};
+
+
+// ------------------------------------
+// Controlled dopri5 onto every sample of the stimulation periods too,
+// as in sensitivity_feedback_concat/adaint_recovery.h
+// ------------------------------------
+struct dopri5_stepper : explicit_stepper
+{
+    dopri5_stepper( double abs_tol , double rel_tol ) : explicit_stepper( abs_tol , rel_tol ) { }
+
+    // the error control keeps the bounds up to about the tolerance
+    double level_slack() const { return m_abs_tol; }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_n( System sys , Jacobian jac , State &x , double &t , size_t n , double dt , Observer obs ) const
+    {
+        bool first = true;      // odeint also observes the start
+        t = boost::numeric::odeint::integrate_n_steps( make_controlled( m_abs_tol , m_rel_tol , runge_kutta_dopri5< State >() ) , sys , x , t , dt , n ,
+                [&first , &obs]( const State &y , double ty ) { if( !first ) obs( y , ty ); first = false; } );
+    }
+};
+
+
+// ------------------------------------
+// Fixed step runge_kutta4 of step (0: the sampling step) for every
+// phase, the recovery relaxation included; a sampling step that is not
+// a multiple of step is split into equal steps no longer than step
+// ------------------------------------
+struct rk4_stepper : explicit_stepper
+{
+    double m_step;
+
+    rk4_stepper( double step , double abs_tol , double rel_tol ) : explicit_stepper( abs_tol , rel_tol ) , m_step( step ) { }
+
+    size_t substeps( double dt ) const { return (m_step > 0.0) ? max( size_t( 1 ) , size_t( ceil( dt/m_step - 1E-9 ) ) ) : 1; }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_n( System sys , Jacobian jac , State &x , double &t , size_t n , double dt , Observer obs ) const
+    {
+        runge_kutta4< State > rk4;
+        size_t m = substeps( dt );
+        for( size_t i=0 ; i<n ; ++i )
+        {
+            for( size_t j=0 ; j<m ; ++j )
+                rk4.do_step( sys , x , t + j*(dt/m) , dt/m );
+            t += dt;
+            obs( x , t );
+        }
+    }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_const( System sys , Jacobian jac , State &x , double t0 , double t1 , double dt , Observer obs ) const
+    {
+        size_t n = size_t( (t1 - t0)/dt + 1E-9 );
+        obs( x , t0 );
+        double t = t0;
+        integrate_n( sys , jac , x , t , n , dt , obs );
+    }
+};
+
+
+// ------------------------------------
+// Stepper chosen at run time: the methods of adaint_options::on_method,
+// off_method, relax_method and probe_method
+// ------------------------------------
+enum { explicit_method = 0 , stiff_method = 1 , dopri5_method = 2 , rk4_method = 3 };
+
+struct configured_stepper
+{
+    int m_method;
+    explicit_stepper m_explicit;
+    stiff_stepper m_stiff;
+    dopri5_stepper m_dopri5;
+    rk4_stepper m_rk4;
+
+    configured_stepper( int method , double abs_tol , double rel_tol , double stiff_abs_tol , double stiff_rel_tol , double rk4_step )
+    : m_method( method ) , m_explicit( abs_tol , rel_tol ) , m_stiff( stiff_abs_tol , stiff_rel_tol ) , m_dopri5( abs_tol , rel_tol ) , m_rk4( rk4_step , abs_tol , rel_tol ) { }
+
+    double level_slack() const
+    {
+        switch( m_method )
+        {
+            case stiff_method : return m_stiff.level_slack();
+            case dopri5_method : return m_dopri5.level_slack();
+            case rk4_method : return m_rk4.level_slack();
+            default : return m_explicit.level_slack();
+        }
+    }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_n( System sys , Jacobian jac , State &x , double &t , size_t n , double dt , Observer obs ) const
+    {
+        switch( m_method )
+        {
+            case stiff_method : m_stiff.integrate_n( sys , jac , x , t , n , dt , obs ); break;
+            case dopri5_method : m_dopri5.integrate_n( sys , jac , x , t , n , dt , obs ); break;
+            case rk4_method : m_rk4.integrate_n( sys , jac , x , t , n , dt , obs ); break;
+            default : m_explicit.integrate_n( sys , jac , x , t , n , dt , obs );
+        }
+    }
+
+    template< class System , class Jacobian , class State , class Observer >
+    void integrate_const( System sys , Jacobian jac , State &x , double t0 , double t1 , double dt , Observer obs ) const
+    {
+        switch( m_method )
+        {
+            case stiff_method : m_stiff.integrate_const( sys , jac , x , t0 , t1 , dt , obs ); break;
+            case rk4_method : m_rk4.integrate_const( sys , jac , x , t0 , t1 , dt , obs ); break;
+            default : m_explicit.integrate_const( sys , jac , x , t0 , t1 , dt , obs );
+        }
+    }
+
+    template< class System , class Jacobian , class State >
+    void coarse_grid( System sys , Jacobian jac , State &x , double t0 , double t1 , double tol , vector<double> &grid ) const
+    {
+        if( m_method == stiff_method )
+            m_stiff.coarse_grid( sys , jac , x , t0 , t1 , tol , grid );
+        else
+            m_explicit.coarse_grid( sys , jac , x , t0 , t1 , tol , grid );
+    }
+
+    template< class System , class Jacobian , class State >
+    void integrate_grid( System sys , Jacobian jac , State &x , const vector<double> &grid ) const
+    {
+        if( m_method == stiff_method )
+            m_stiff.integrate_grid( sys , jac , x , grid );
+        else
+            m_explicit.integrate_grid( sys , jac , x , grid );
+    }
+};
+
+
+// ------------------------------------
+// Stepper policy: one stepper for each phase of the protocol (ON and
+// OFF phases of the habituation, recovery relaxation, test periods of
+// the recovery). The engine takes a policy or a single stepper, which
+// then serves every phase; on_stepper, off_stepper, relax_stepper and
+// probe_stepper give the stepper of a phase.
+// ------------------------------------
+template< class On , class Off = On , class Relax = Off , class Probe = On >
+struct phase_steppers
+{
+    On on;
+    Off off;
+    Relax relax;
+    Probe probe;
+
+    phase_steppers( const On &on_ , const Off &off_ , const Relax &relax_ , const Probe &probe_ ) : on( on_ ) , off( off_ ) , relax( relax_ ) , probe( probe_ ) { }
+};
+
+template< class Stepper > const Stepper& on_stepper( const Stepper &s ) { return s; }
+template< class Stepper > const Stepper& off_stepper( const Stepper &s ) { return s; }
+template< class Stepper > const Stepper& relax_stepper( const Stepper &s ) { return s; }
+template< class Stepper > const Stepper& probe_stepper( const Stepper &s ) { return s; }
+
+template< class On , class Off , class Relax , class Probe >
+const On& on_stepper( const phase_steppers< On , Off , Relax , Probe > &s ) { return s.on; }
+template< class On , class Off , class Relax , class Probe >
+const Off& off_stepper( const phase_steppers< On , Off , Relax , Probe > &s ) { return s.off; }
+template< class On , class Off , class Relax , class Probe >
+const Relax& relax_stepper( const phase_steppers< On , Off , Relax , Probe > &s ) { return s.relax; }
+template< class On , class Off , class Relax , class Probe >
+const Probe& probe_stepper( const phase_steppers< On , Off , Relax , Probe > &s ) { return s.probe; }
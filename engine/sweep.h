@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include "batch.h"
+#include "parameter_loader.h"
+#include "trajectory_sink.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Protocol grid of a sweep: every period with every amplitude (and
+// every ton, opt.ton if empty)
+// ------------------------------------
+struct sweep_grid
+{
+    vector<double> T;
+    vector<double> Amax;
+    vector<double> ton;
+
+    size_t n_ton() const { return ton.empty() ? 1 : ton.size(); }
+    size_t cells() const { return T.size()*Amax.size()*n_ton(); }
+};
+
+
+// ht and rt of every (parameter set, T, Amax, ton), ton fastest
+struct sweep_result
+{
+    size_t n_sets;
+    size_t n_T;
+    size_t n_Amax;
+    size_t n_ton;
+    vector<double> ht;
+    vector<double> rt;
+
+    size_t index( size_t set , size_t i , size_t j , size_t k = 0 ) const { return ((set*n_T + i)*n_Amax + j)*n_ton + k; }
+    size_t size() const { return ht.size(); }
+};
+
+
+// columns of the rows streamed to the sweep file
+enum { sweep_set = 0 , sweep_T_index , sweep_Amax_index , sweep_ton_index , sweep_T , sweep_Amax , sweep_ton , sweep_ht , sweep_rt , sweep_columns };
+
+
+// ------------------------------------
+// adaint_recovery of every parameter set (params, n_sets x n_params)
+// on every cell of grid, on the parallel_for pool. run is called as in
+// adaint_recovery_batch. The cells are handed out longest period
+// first, so the long runs do not end up last on one thread. Every
+// finished cell is written to fnm (if given) as one row of
+// sweep_columns values: set, the three grid indices, T, Amax, ton, ht
+// and rt; the rows come in completion order, the indices place them.
+// The format follows the file name (make_trajectory_sink, .npy for a
+// binary table). Returns false if the file cannot be written.
+// ------------------------------------
+template< class Run >
+bool adaint_recovery_sweep( sweep_result &res , const sweep_grid &grid , const double *params , size_t n_sets , size_t n_params , const vector<double> &x0 ,
+                            Run run , const adaint_options &opt , const char *fnm = 0 , unsigned n_threads = 0 )
+{
+    res.n_sets = n_sets;
+    res.n_T = grid.T.size();
+    res.n_Amax = grid.Amax.size();
+    res.n_ton = grid.n_ton();
+    size_t n = n_sets*grid.cells();
+    res.ht.assign( n , 60.0 );
+    res.rt.assign( n , -1.0 );
+
+    vector< size_t > order( n );
+    iota( order.begin() , order.end() , size_t( 0 ) );
+    size_t per_T = res.n_Amax*res.n_ton;
+    stable_sort( order.begin() , order.end() , [&]( size_t a , size_t b ) { return grid.T[(a/per_T) % res.n_T] > grid.T[(b/per_T) % res.n_T]; } );
+
+    unique_ptr< trajectory_sink > sink;
+    if( fnm )
+    {
+        sink = make_trajectory_sink( fnm );
+        if( !sink->open( fnm , n , sweep_columns ) )
+            return false;
+    }
+    mutex sink_mutex;
+
+    parallel_for( n , [&]( size_t q ) {
+        size_t c = order[q];
+        size_t k = c % res.n_ton , j = (c / res.n_ton) % res.n_Amax , i = (c / per_T) % res.n_T , set = c / (per_T*res.n_T);
+        adaint_options o = opt;
+        if( !grid.ton.empty() )
+            o.ton = grid.ton[k];
+        vector<double> p0( params + set*n_params , params + (set+1)*n_params );
+        vector<double> result( 2 , -1.0 );
+        res.ht[c] = run( result , grid.T[i] , grid.Amax[j] , p0 , x0 , o );
+        res.rt[c] = result[1];
+        if( sink )
+        {
+            double row[sweep_columns] = { double( set ) , double( i ) , double( j ) , double( k ) , grid.T[i] , grid.Amax[j] , o.ton , res.ht[c] , res.rt[c] };
+            lock_guard< mutex > lock( sink_mutex );
+            sink->write( row );
+        }
+    } , n_threads );
+
+    return sink ? sink->close() : true;
+}
+
+
+// the sweep of a compiled model on the parameter sets of a table
+// (load_model_parameters)
+template< class Model >
+bool adaint_recovery_sweep( sweep_result &res , const sweep_grid &grid , const parameter_table &sets , const typename Model::state_type &x0 ,
+                            const adaint_options &opt , int recovery_true , const char *fnm = 0 , unsigned n_threads = 0 )
+{
+    vector<double> x( x0.begin() , x0.end() );
+    return adaint_recovery_sweep( res , grid , sets.values.data() , sets.rows() , sets.n_columns , x ,
+        [&]( vector<double> &result , double T , double Amax , const vector<double> &p0 , const vector<double> &xv , const adaint_options &o ) {
+            typename Model::state_type s;
+            std::copy( xv.begin() , xv.end() , s.begin() );
+            return adaint_recovery< Model >( result , T , Amax , p0 , s , o , 0 , "" , recovery_true );
+        } , opt , fnm , n_threads );
+}
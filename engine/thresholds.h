@@ -0,0 +1,160 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "adaint_recovery.h"
+
+
+using namespace std;
+
+
+// ------------------------------------
+// adaint_recovery for several habituation thresholds (int_threshold)
+// and recovery thresholds (recovery_threshold) from one integration.
+// The periods are integrated until the criterion of every habituation
+// threshold has stopped, so each threshold sees the same peaks as a
+// run of its own. The recovery relaxation is shared by the thresholds
+// stopping at the same sample, and the test periods by the recovery
+// thresholds (bisection on a cached, monotone response).
+// ------------------------------------
+struct threshold_times
+{
+    vector<double> ht;          // per habituation threshold, result[0] of adaint_recovery (60 if rejected)
+    vector<double> rt;          // rt[k*n_recovery + j], result[1] of adaint_recovery (-1 if not computed or rejected)
+    size_t n_recovery;
+
+    double recovery( size_t k , size_t j ) const { return rt[k*n_recovery + j]; }
+};
+
+
+// state of the stopping criterion of one habituation threshold
+struct threshold_criterion
+{
+    adaint_options opt;
+    python_stopping_rule stopping_rule;
+    sliding_maxnorm_ht sliding;
+    int periods;                // periods integrated when the criterion stopped, 0 while running
+    int sliding_ht;
+
+    threshold_criterion( const adaint_options &o ) : opt( o ) ,
+        stopping_rule( o.int_threshold , o.min_output_level , o.steady_counter_threshold , o.increasing_counter_threshold ) ,
+        sliding( o.int_threshold ) , periods( 0 ) , sliding_ht( 0 ) { }
+
+    // feeds the peak of period n, true once the criterion has stopped
+    bool push( const vector<double> &peaks , int n , double t , double T )
+    {
+        if( periods > 0 )
+            return true;
+        sliding.push( peaks.back() );
+        sliding_ht = sliding.ht();
+        bool stop;
+        if( opt.criterion == python_criterion )
+            stop = stopping_rule.push( peaks.back() ) || (n >= (opt.num_periods_per_expansion << opt.max_expansion_attempts));
+        else
+            stop = ((n >= 2) && (abs(1 - peaks[n-1]/peaks[n-2]) < opt.int_threshold)) || (t > opt.max_periods*T);
+        if( stop )
+            periods = n;
+        return stop;
+    }
+};
+
+
+template< class Systems , class Stepper >
+void adaint_recovery_thresholds_systems( const Systems &s , const Stepper &stepper , habituation_data< typename Systems::state_type > &data , threshold_times &res ,
+                                         double T , const typename Systems::state_type &x0 , const adaint_options &opt ,
+                                         const vector<double> &ht_thresholds , const vector<double> &recovery_thresholds , int recovery_true )
+{
+    typedef typename Systems::state_type state_type;
+
+    int Ton_duration = int(opt.ton / opt.step_size) ;
+    int Toff_duration = int((T - opt.ton)/opt.step_size) ;
+
+    vector< threshold_criterion > criteria;
+    for( size_t k=0 ; k<ht_thresholds.size() ; ++k )
+    {
+        adaint_options o = opt;
+        o.int_threshold = ht_thresholds[k];
+        criteria.push_back( threshold_criterion( o ) );
+    }
+
+    state_type x = x0;
+    double t = 0.0;
+    push_back_trajectory< Systems > obs( data , s , false );
+    if( !opt.checkpoints )
+        obs( x , t );
+    data.ht = 0;
+
+    bool running = !criteria.empty();
+    while( running )
+    {
+        data.ht+=1;
+        if( !stimulation_period( data , s , stepper , x , t , Ton_duration , Toff_duration , opt ) )
+            break;
+        running = false;
+        for( size_t k=0 ; k<criteria.size() ; ++k )
+            if( !criteria[k].push( data.peaks_level , data.ht , t , T ) )
+                running = true;
+    }
+
+    res.n_recovery = recovery_thresholds.size();
+    res.ht.assign( criteria.size() , 60.0 );
+    res.rt.assign( criteria.size()*res.n_recovery , -1.0 );
+
+    // one relaxation per distinct starting sample
+    map< size_t , unique_ptr< recovery_response< Systems , Stepper > > > responses;
+    for( size_t k=0 ; k<criteria.size() ; ++k )
+    {
+        const threshold_criterion &c = criteria[k];
+        if( c.periods == 0 )
+            continue;       // rejected before this criterion stopped
+        bool python = (c.opt.criterion == python_criterion);
+        res.ht[k] = python ? c.sliding_ht : c.periods - 1;
+        bool habituated = python ? (res.ht[k] > 0) : (res.ht[k] < 50);
+        if( !recovery_true || !habituated )
+            continue;
+
+        size_t last = recovery_start( 1 + c.periods*(Ton_duration+Toff_duration) , c.sliding_ht , T , c.opt );
+        if( !responses[last] )
+        {
+            state_type x_recov;
+            double t_recov;
+            habituation_sample( x_recov , t_recov , data , s , stepper , last , T , opt );
+            responses[last].reset( new recovery_response< Systems , Stepper >( s , stepper , T , x_recov , t_recov , opt ) );
+        }
+        recovery_response< Systems , Stepper > &response = *responses[last];
+
+        for( size_t j=0 ; j<res.n_recovery ; ++j )
+        {
+            double rt;
+            if( response.time( rt , recovery_thresholds[j] , data.peaks_level[0] ) )
+                res.rt[k*res.n_recovery + j] = rt;
+        }
+    }
+}
+
+
+template< class Systems , class Stepper >
+void adaint_recovery_thresholds_systems( const Systems &s , const Stepper &stepper , threshold_times &res , double T , const typename Systems::state_type &x0 , const adaint_options &opt ,
+                                         const vector<double> &ht_thresholds , const vector<double> &recovery_thresholds , int recovery_true )
+{
+    habituation_data< typename Systems::state_type > data;
+    adaint_recovery_thresholds_systems( s , stepper , data , res , T , x0 , opt , ht_thresholds , recovery_thresholds , recovery_true );
+}
+
+
+template< class Model >
+void adaint_recovery_thresholds( threshold_times &res , double T , double Amax , const vector<double> &p0 , const typename Model::state_type &x0 , const adaint_options &opt ,
+                                 const vector<double> &ht_thresholds , const vector<double> &recovery_thresholds , int recovery_true )
+{
+    vector<double> full_param( p0.begin() , p0.end() );
+    full_param.push_back(Amax);
+    model_systems< Model > s( full_param );
+
+    if( phase_methods( opt ) )
+        adaint_recovery_thresholds_systems( s , configured_policy< Model >( opt ) , res , T , x0 , opt , ht_thresholds , recovery_thresholds , recovery_true );
+    else if( use_stiff_stepper< Model >( opt ) )
+        adaint_recovery_thresholds_systems( s , stiff_stepper( opt.stiff_abs_tol , opt.stiff_rel_tol ) , res , T , x0 , opt , ht_thresholds , recovery_thresholds , recovery_true );
+    else
+        adaint_recovery_thresholds_systems( s , explicit_stepper( opt.abs_tol , opt.rel_tol ) , res , T , x0 , opt , ht_thresholds , recovery_thresholds , recovery_true );
+}
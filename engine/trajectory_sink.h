@@ -0,0 +1,334 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef HABITUATION_ZLIB
+#include <zlib.h>
+#endif
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Output file with a large buffer, plain or gzip compressed (files
+// ending in .gz, needs -DHABITUATION_ZLIB and -lz).
+// ------------------------------------
+class buffered_file
+{
+    FILE *m_file;
+#ifdef HABITUATION_ZLIB
+    gzFile m_gz;
+#endif
+    vector< char > m_buffer;
+    size_t m_used;
+    bool m_ok;
+
+    buffered_file( const buffered_file& );
+    buffered_file& operator=( const buffered_file& );
+
+    bool flush()
+    {
+        if( m_used == 0 )
+            return m_ok;
+#ifdef HABITUATION_ZLIB
+        if( m_gz )
+            m_ok = m_ok && (gzwrite( m_gz , m_buffer.data() , unsigned( m_used ) ) == int( m_used ));
+        else
+#endif
+            m_ok = m_ok && (fwrite( m_buffer.data() , 1 , m_used , m_file ) == m_used);
+        m_used = 0;
+        return m_ok;
+    }
+
+public:
+    buffered_file( size_t buffer_size = 1 << 20 ) : m_file( 0 ) ,
+#ifdef HABITUATION_ZLIB
+        m_gz( 0 ) ,
+#endif
+        m_buffer( buffer_size ) , m_used( 0 ) , m_ok( false ) { }
+    ~buffered_file() { close(); }
+
+    static bool compressed( const string &fnm ) { return (fnm.size() > 3) && (fnm.compare( fnm.size()-3 , 3 , ".gz" ) == 0); }
+
+    bool open( const string &fnm , int level = 1 )
+    {
+        close();
+        if( compressed( fnm ) )
+        {
+#ifdef HABITUATION_ZLIB
+            char mode[8];
+            snprintf( mode , sizeof(mode) , "wb%d" , level );
+            m_gz = gzopen( fnm.c_str() , mode );
+            m_ok = (m_gz != 0);
+#else
+            (void) level;
+            cerr << "buffered_file: " << fnm << ": compile with -DHABITUATION_ZLIB -lz for compressed output" << endl;
+            m_ok = false;
+#endif
+        }
+        else
+        {
+            m_file = fopen( fnm.c_str() , "wb" );
+            m_ok = (m_file != 0);
+        }
+        if( !m_ok )
+            cerr << "buffered_file: cannot write " << fnm << endl;
+        return m_ok;
+    }
+
+    void write( const void *data , size_t n )
+    {
+        const char *p = (const char*) data;
+        while( n > 0 )
+        {
+            if( m_used == m_buffer.size() )
+                flush();
+            size_t k = min( n , m_buffer.size() - m_used );
+            memcpy( m_buffer.data() + m_used , p , k );
+            m_used += k;
+            p += k;
+            n -= k;
+        }
+    }
+
+    bool close()
+    {
+        bool ok = flush();
+        if( m_file )
+            ok = (fclose( m_file ) == 0) && ok;
+        m_file = 0;
+#ifdef HABITUATION_ZLIB
+        if( m_gz )
+            ok = (gzclose( m_gz ) == Z_OK) && ok;
+        m_gz = 0;
+#endif
+        m_ok = false;
+        return ok;
+    }
+};
+
+
+// ------------------------------------
+// Where write_trajectory sends its rows (time followed by the state).
+// The number of rows is known when the sink is opened.
+// ------------------------------------
+class trajectory_sink
+{
+public:
+    virtual ~trajectory_sink() { }
+    virtual bool open( const string &fnm , size_t n_rows , size_t n_columns ) = 0;
+    virtual void write( const double *row ) = 0;
+    virtual bool close() = 0;
+};
+
+
+// the text format of the C++ copies: values separated by and ending
+// with a space, one row per line
+class text_sink : public trajectory_sink
+{
+    buffered_file m_file;
+    size_t m_columns;
+
+public:
+    text_sink() : m_columns( 0 ) { }
+
+    bool open( const string &fnm , size_t , size_t n_columns )
+    {
+        m_columns = n_columns;
+        return m_file.open( fnm );
+    }
+
+    void write( const double *row )
+    {
+        char line[32];
+        for( size_t j=0 ; j<m_columns ; ++j )
+        {
+            int n = snprintf( line , sizeof(line) , "%g " , row[j] );
+            m_file.write( line , n );
+        }
+        m_file.write( "\n" , 1 );
+    }
+
+    bool close() { return m_file.close(); }
+};
+
+
+// numpy .npy (version 1.0, little-endian float64, n_rows x n_columns),
+// read with np.load (np.load(gzip.open(fnm)) for .npy.gz)
+class npy_sink : public trajectory_sink
+{
+    buffered_file m_file;
+    size_t m_columns;
+
+public:
+    npy_sink() : m_columns( 0 ) { }
+
+    bool open( const string &fnm , size_t n_rows , size_t n_columns )
+    {
+        m_columns = n_columns;
+        if( !m_file.open( fnm ) )
+            return false;
+        char dict[128];
+        int n = snprintf( dict , sizeof(dict) , "{'descr': '<f8', 'fortran_order': False, 'shape': (%zu, %zu), }" , n_rows , n_columns );
+        // magic, version, header length, dict padded with spaces and a newline to a multiple of 64
+        size_t header = 10 + n + 1;
+        size_t padded = (header + 63)/64*64;
+        unsigned short length = (unsigned short)( padded - 10 );
+        m_file.write( "\x93NUMPY\x01\x00" , 8 );
+        unsigned char le[2] = { (unsigned char)( length & 0xff ) , (unsigned char)( length >> 8 ) };
+        m_file.write( le , 2 );
+        m_file.write( dict , n );
+        m_file.write( string( padded - header , ' ' ).c_str() , padded - header );
+        m_file.write( "\n" , 1 );
+        return true;
+    }
+
+    void write( const double *row ) { m_file.write( row , m_columns*sizeof(double) ); }
+
+    bool close() { return m_file.close(); }
+};
+
+
+
+
+// ------------------------------------
+// Chunked trajectory store (.htraj) for long runs, read back as numpy
+// memmap views by python/trajectory_store.py. Layout (little-endian):
+//   header (4096 bytes): magic "HTRAJ01\n", then uint64 n_samples,
+//       n_columns, chunk_size, n_chunks, data_offset, summary_offset,
+//       followed by the column names separated by '\n'
+//   data: n_chunks x n_columns x chunk_size float64, each chunk holds
+//       chunk_size consecutive samples of one column (the last chunk
+//       is padded with nan)
+//   summary: n_chunks x n_columns x 2 float64, min and max of each chunk
+// Column 0 is the time.
+// ------------------------------------
+class store_sink : public trajectory_sink
+{
+    FILE *m_file;
+    size_t m_columns;
+    size_t m_chunk_size;
+    size_t m_samples;
+    size_t m_in_chunk;
+    bool m_ok;                          // all writes so far succeeded
+    vector< double > m_chunk;           // n_columns x chunk_size
+    vector< double > m_summary;
+    vector< string > m_names;
+
+    static const size_t header_size = 4096;
+
+    void write_chunk()
+    {
+        for( size_t j=0 ; j<m_columns ; ++j )
+        {
+            double *c = m_chunk.data() + j*m_chunk_size;
+            double lo = c[0] , hi = c[0];
+            for( size_t i=1 ; i<m_in_chunk ; ++i )
+            {
+                lo = min( lo , c[i] );
+                hi = max( hi , c[i] );
+            }
+            m_summary.push_back( lo );
+            m_summary.push_back( hi );
+            for( size_t i=m_in_chunk ; i<m_chunk_size ; ++i )
+                c[i] = numeric_limits< double >::quiet_NaN();
+        }
+        m_ok &= (fwrite( m_chunk.data() , sizeof(double) , m_chunk.size() , m_file ) == m_chunk.size());
+        m_in_chunk = 0;
+    }
+
+public:
+    // names of the state variables (x0, x1, ... if empty)
+    store_sink( size_t chunk_size = 1 << 16 , const vector< string > &names = vector< string >() )
+    : m_file( 0 ) , m_columns( 0 ) , m_chunk_size( chunk_size ) , m_samples( 0 ) , m_in_chunk( 0 ) , m_ok( false ) , m_names( names ) { }
+    ~store_sink() { close(); }
+
+    bool open( const string &fnm , size_t , size_t n_columns )
+    {
+        m_file = fopen( fnm.c_str() , "wb" );
+        if( !m_file )
+        {
+            cerr << "store_sink: cannot write " << fnm << endl;
+            return false;
+        }
+        m_columns = n_columns;
+        m_samples = 0;
+        m_in_chunk = 0;
+        m_chunk.assign( m_columns*m_chunk_size , 0.0 );
+        m_summary.clear();
+        vector< char > header( header_size , 0 );
+        m_ok = (fwrite( header.data() , 1 , header_size , m_file ) == header_size);
+        return m_ok;
+    }
+
+    void write( const double *row )
+    {
+        for( size_t j=0 ; j<m_columns ; ++j )
+            m_chunk[j*m_chunk_size + m_in_chunk] = row[j];
+        ++m_samples;
+        if( ++m_in_chunk == m_chunk_size )
+            write_chunk();
+    }
+
+    bool close()
+    {
+        if( !m_file )
+            return true;
+        if( m_in_chunk > 0 )
+            write_chunk();
+        size_t n_chunks = m_summary.size()/(2*m_columns);
+        size_t summary_offset = header_size + n_chunks*m_columns*m_chunk_size*sizeof(double);
+        m_ok &= (fwrite( m_summary.data() , sizeof(double) , m_summary.size() , m_file ) == m_summary.size());
+
+        vector< char > header( header_size , 0 );
+        memcpy( header.data() , "HTRAJ01\n" , 8 );
+        unsigned long long fields[6] = { m_samples , m_columns , m_chunk_size , n_chunks , header_size , summary_offset };
+        memcpy( header.data() + 8 , fields , sizeof(fields) );
+        string names = "t";
+        for( size_t j=1 ; j<m_columns ; ++j )
+            names += "\n" + ((j <= m_names.size()) ? m_names[j-1] : "x" + to_string( j-1 ));
+        memcpy( header.data() + 8 + sizeof(fields) , names.data() , min( names.size() , header_size - 8 - sizeof(fields) - 1 ) );
+        bool ok = m_ok && (fseek( m_file , 0 , SEEK_SET ) == 0);
+        ok = ok && (fwrite( header.data() , 1 , header_size , m_file ) == header_size);
+        ok = (fflush( m_file ) == 0) && !ferror( m_file ) && ok;
+        ok = (fclose( m_file ) == 0) && ok;
+        m_file = 0;
+        return ok;
+    }
+};
+
+
+inline bool has_extension( const string &fnm , const string &ext )
+{
+    return (fnm.size() > ext.size()) && (fnm.compare( fnm.size()-ext.size() , ext.size() , ext ) == 0);
+}
+
+
+// store_sink for .htraj, npy_sink for .npy or .npy.gz, text_sink otherwise
+inline unique_ptr< trajectory_sink > make_trajectory_sink( const string &fnm )
+{
+    string name = buffered_file::compressed( fnm ) ? fnm.substr( 0 , fnm.size()-3 ) : fnm;
+    if( has_extension( fnm , ".htraj" ) )
+        return unique_ptr< trajectory_sink >( new store_sink() );
+    if( has_extension( name , ".npy" ) )
+        return unique_ptr< trajectory_sink >( new npy_sink() );
+    return unique_ptr< trajectory_sink >( new text_sink() );
+}
+
+
+// run.htraj -> run.recovery.htraj, the file of the recovery relaxation
+inline string recovery_file_name( const string &fnm )
+{
+    size_t slash = fnm.find_last_of( '/' );
+    size_t dot = fnm.find( '.' , (slash == string::npos) ? 0 : slash+1 );
+    if( dot == string::npos )
+        return fnm + ".recovery";
+    return fnm.substr( 0 , dot ) + ".recovery" + fnm.substr( dot );
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <boost/array.hpp>
+
+
+using namespace std;
+
+
+// ------------------------------------
+// Array of doubles growing by fixed chunks: push_back never moves the
+// stored values, and clear() keeps the chunks for the next run, so a
+// sweep allocates only while its longest run grows.
+// ------------------------------------
+class chunked_column
+{
+    static const size_t chunk_bits = 13;
+    static const size_t chunk_size = size_t( 1 ) << chunk_bits;
+    static const size_t chunk_mask = chunk_size - 1;
+
+    vector< unique_ptr< double[] > > m_chunks;
+    size_t m_size;
+
+public:
+    chunked_column() : m_size( 0 ) { }
+
+    void push_back( double v )
+    {
+        if( (m_size >> chunk_bits) == m_chunks.size() )
+            m_chunks.push_back( unique_ptr< double[] >( new double[chunk_size] ) );
+        m_chunks[m_size >> chunk_bits][m_size & chunk_mask] = v;
+        ++m_size;
+    }
+
+    double operator[]( size_t i ) const { return m_chunks[i >> chunk_bits][i & chunk_mask]; }
+    double back() const { return (*this)[m_size-1]; }
+    size_t size() const { return m_size; }
+    void clear() { m_size = 0; }
+
+    // index of the first maximum in [begin, end)
+    size_t max_index( size_t begin , size_t end ) const
+    {
+        size_t row = begin;
+        for( size_t i=begin+1 ; i<end ; ++i )
+            if( (*this)[i] > (*this)[row] )
+                row = i;
+        return row;
+    }
+};
+
+
+// ------------------------------------
+// Trajectory of an N-variable model stored by columns: the times and
+// one column per variable. The output is one of the columns, it is not
+// stored a second time.
+// ------------------------------------
+template< size_t N >
+struct trajectory_columns
+{
+    chunked_column times;
+    boost::array< chunked_column , N > x;
+
+    template< class State >
+    void push_back( const State &s , double t )
+    {
+        times.push_back( t );
+        for( size_t j=0 ; j<N ; ++j )
+            x[j].push_back( s[j] );
+    }
+
+    // gathers sample i into s
+    template< class State >
+    void state( size_t i , State &s ) const
+    {
+        for( size_t j=0 ; j<N ; ++j )
+            s[j] = x[j][i];
+    }
+
+    size_t size() const { return times.size(); }
+
+    void clear()
+    {
+        times.clear();
+        for( size_t j=0 ; j<N ; ++j )
+            x[j].clear();
+    }
+};
+
+
+// observer of integrate_const appending to a trajectory_columns
+template< size_t N >
+struct push_back_columns
+{
+    trajectory_columns< N > &m_trajectory;
+
+    push_back_columns( trajectory_columns< N > &trajectory ) : m_trajectory( trajectory ) { }
+
+    template< class State >
+    void operator()( const State &x , double t ) { m_trajectory.push_back( x , t ); }
+};
+
+
+// observer keeping only one variable (the output of a test period)
+struct push_back_variable
+{
+    vector< double > &m_out;
+    size_t m_index;
+
+    push_back_variable( vector< double > &out , size_t index ) : m_out( out ) , m_index( index ) { }
+
+    template< class State >
+    void operator()( const State &x , double /*t*/ ) { m_out.push_back( x[m_index] ); }
+};
+
+
+// ------------------------------------
+// Buffers of adaint_recovery, owned by the caller (or one per thread,
+// thread_workspace) and reset at the start of every run. The memory of
+// the longest run is kept for the next ones.
+// ------------------------------------
+template< size_t N >
+struct adaint_workspace
+{
+    trajectory_columns< N > trajectory;     // habituation
+    trajectory_columns< N > recovery;       // relaxation after habituation
+    vector< double > test_output;           // output of one test period
+    vector< double > peaks_time;
+    vector< double > peaks_level;
+
+    void reset()
+    {
+        trajectory.clear();
+        recovery.clear();
+        test_output.clear();
+        peaks_time.clear();
+        peaks_level.clear();
+    }
+};
+
+
+template< size_t N >
+adaint_workspace< N >& thread_workspace()
+{
+    static thread_local adaint_workspace< N > workspace;
+    return workspace;
+}
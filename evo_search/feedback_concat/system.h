@@ -24,7 +24,8 @@ class IFF_concat_MAX {
     vector<double> m_gam;
 public:
     IFF_concat_MAX( vector<double> &gam ) : m_gam(gam) { }
-    void operator() (const state_type &x, state_type &dxdt, const double t) const {
+    template< class State >
+    void operator() (const State &x, State &dxdt, const double t) const {
         dxdt[0] = m_gam[14]*m_gam[0]*(Rt1-x[0]) - m_gam[1]*x[0];
         dxdt[1] = x[2]*m_gam[2]*(It1-x[1]) - m_gam[3]*x[1];
         dxdt[2] = x[0]*m_gam[4]*(Ot1-x[2]) - x[1]*m_gam[5]*x[2]/(m_gam[6]+x[2]);
@@ -38,7 +39,8 @@ class IFF_concat_MIN {
     vector<double> m_gam;
 public:
     IFF_concat_MIN( vector<double> &gam ) : m_gam(gam) { }
-    void operator() (const state_type &x, state_type &dxdt, const double t) const {
+    template< class State >
+    void operator() (const State &x, State &dxdt, const double t) const {
         dxdt[0] =  - m_gam[1]*x[0];
         dxdt[1] = x[2]*m_gam[2]*(It1-x[1]) - m_gam[3]*x[1];
         dxdt[2] = x[0]*m_gam[4]*(Ot1-x[2]) - x[1]*m_gam[5]*x[2]/(m_gam[6]+x[2]);
@@ -46,4 +48,74 @@ public:
         dxdt[4] = x[5]*m_gam[7]*(It2-x[4]) - m_gam[8]*x[4];
         dxdt[5] = x[3]*m_gam[9]*(Ot2-x[5]) - x[4]*m_gam[10]*x[5]/(m_gam[11]+x[5]);
     }
+};
+
+
+// Analytic Jacobians, needed by the implicit (rosenbrock4) steppers
+class IFF_concat_MAX_jacobian {
+    vector<double> m_gam;
+public:
+    IFF_concat_MAX_jacobian( vector<double> &gam ) : m_gam(gam) { }
+    template< class State , class Matrix >
+    void operator() (const State &x, Matrix &J, const double t, State &dfdt) const {
+        J.clear();
+        J(0,0) = -m_gam[14]*m_gam[0] - m_gam[1];
+        J(1,1) = -x[2]*m_gam[2] - m_gam[3];
+        J(1,2) = m_gam[2]*(It1-x[1]);
+        J(2,0) = m_gam[4]*(Ot1-x[2]);
+        J(2,1) = -m_gam[5]*x[2]/(m_gam[6]+x[2]);
+        J(2,2) = -x[0]*m_gam[4] - x[1]*m_gam[5]*m_gam[6]/((m_gam[6]+x[2])*(m_gam[6]+x[2]));
+        J(3,2) = m_gam[12]*(Rt2-x[3]);
+        J(3,3) = -x[2]*m_gam[12] - m_gam[13];
+        J(4,4) = -x[5]*m_gam[7] - m_gam[8];
+        J(4,5) = m_gam[7]*(It2-x[4]);
+        J(5,3) = m_gam[9]*(Ot2-x[5]);
+        J(5,4) = -m_gam[10]*x[5]/(m_gam[11]+x[5]);
+        J(5,5) = -x[3]*m_gam[9] - x[4]*m_gam[10]*m_gam[11]/((m_gam[11]+x[5])*(m_gam[11]+x[5]));
+        for( size_t i=0 ; i<6 ; ++i )
+            dfdt[i] = 0.0;
+    }
+};
+
+class IFF_concat_MIN_jacobian {
+    vector<double> m_gam;
+public:
+    IFF_concat_MIN_jacobian( vector<double> &gam ) : m_gam(gam) { }
+    template< class State , class Matrix >
+    void operator() (const State &x, Matrix &J, const double t, State &dfdt) const {
+        J.clear();
+        J(0,0) = -m_gam[1];
+        J(1,1) = -x[2]*m_gam[2] - m_gam[3];
+        J(1,2) = m_gam[2]*(It1-x[1]);
+        J(2,0) = m_gam[4]*(Ot1-x[2]);
+        J(2,1) = -m_gam[5]*x[2]/(m_gam[6]+x[2]);
+        J(2,2) = -x[0]*m_gam[4] - x[1]*m_gam[5]*m_gam[6]/((m_gam[6]+x[2])*(m_gam[6]+x[2]));
+        J(3,2) = m_gam[12]*(Rt2-x[3]);
+        J(3,3) = -x[2]*m_gam[12] - m_gam[13];
+        J(4,4) = -x[5]*m_gam[7] - m_gam[8];
+        J(4,5) = m_gam[7]*(It2-x[4]);
+        J(5,3) = m_gam[9]*(Ot2-x[5]);
+        J(5,4) = -m_gam[10]*x[5]/(m_gam[11]+x[5]);
+        J(5,5) = -x[3]*m_gam[9] - x[4]*m_gam[10]*m_gam[11]/((m_gam[11]+x[5])*(m_gam[11]+x[5]));
+        for( size_t i=0 ; i<6 ; ++i )
+            dfdt[i] = 0.0;
+    }
+};
+
+
+// Description of the model for the shared engine (../engine)
+struct IFF_concat {
+    typedef ::state_type state_type;
+    typedef IFF_concat_MAX system_on;
+    typedef IFF_concat_MIN system_off;
+    typedef IFF_concat_MAX_jacobian jacobian_on;
+    typedef IFF_concat_MIN_jacobian jacobian_off;
+    static const size_t output = 5;
+    static const bool stiff = false;
+    static const size_t n_conserved = 0;
+    static vector< vector<double> > conservation_laws() { return { }; }
+    static const size_t n_fast = 0;
+    static vector< size_t > fast_variables() { return { }; }
+    // number of parameters (p0 followed by Amax)
+    static const size_t n_parameters = 15;
 };
\ No newline at end of file
@@ -16,7 +16,8 @@ class IFF_concat_MAX {
     vector<double> m_gam;
 public:
     IFF_concat_MAX( vector<double> &gam ) : m_gam(gam) { }
-    void operator() (const state_type &x, state_type &dxdt, const double t) const {
+    template< class State >
+    void operator() (const State &x, State &dxdt, const double t) const {
         dxdt[0] = m_gam[2]*(1.0-x[0]-x[5]) - m_gam[0]*m_gam[10]*(1.0-x[1]-x[5]);
         dxdt[1] = m_gam[1]*(1.0-x[0]-x[1]) - m_gam[2]*(1.0-x[0]-x[5]) + m_gam[3]*x[3]*x[5];
         dxdt[2] = x[5]*m_gam[4]*(1.0-x[2]) - m_gam[5]*x[2];
@@ -30,7 +31,8 @@ class IFF_concat_MIN {
     vector<double> m_gam;
 public:
     IFF_concat_MIN( vector<double> &gam ) : m_gam(gam) { }
-    void operator() (const state_type &x, state_type &dxdt, const double t) const {
+    template< class State >
+    void operator() (const State &x, State &dxdt, const double t) const {
         dxdt[0] = m_gam[2]*(1.0-x[0]-x[5]) ;
         dxdt[1] = m_gam[1]*(1.0-x[0]-x[1]) - m_gam[2]*(1.0-x[0]-x[5]) + m_gam[3]*x[3]*x[5];
         dxdt[2] = x[5]*m_gam[4]*(1.0-x[2]) - m_gam[5]*x[2];
@@ -38,4 +40,83 @@ public:
         dxdt[4] = x[2]*m_gam[6]*(1.0-x[4]) - m_gam[7]*x[4];
         dxdt[5] =  - m_gam[1]*(1.0-x[0]-x[1]) - m_gam[3]*x[3]*x[5];
     }
+};
+
+
+// Analytic Jacobians, needed by the implicit (rosenbrock4) steppers
+class IFF_concat_MAX_jacobian {
+    vector<double> m_gam;
+public:
+    IFF_concat_MAX_jacobian( vector<double> &gam ) : m_gam(gam) { }
+    template< class State , class Matrix >
+    void operator() (const State &x, Matrix &J, const double t, State &dfdt) const {
+        J.clear();
+        J(0,0) = -m_gam[2];
+        J(0,1) = m_gam[0]*m_gam[10];
+        J(0,5) = -m_gam[2] + m_gam[0]*m_gam[10];
+        J(1,0) = -m_gam[1] + m_gam[2];
+        J(1,1) = -m_gam[1];
+        J(1,3) = m_gam[3]*x[5];
+        J(1,5) = m_gam[2] + m_gam[3]*x[3];
+        J(2,2) = -x[5]*m_gam[4] - m_gam[5];
+        J(2,5) = m_gam[4]*(1.0-x[2]);
+        J(3,3) = -x[4]*m_gam[8] - m_gam[9];
+        J(3,4) = m_gam[8]*(1.0-x[3]);
+        J(4,2) = m_gam[6]*(1.0-x[4]);
+        J(4,4) = -x[2]*m_gam[6] - m_gam[7];
+        J(5,0) = m_gam[1];
+        J(5,1) = -m_gam[0]*m_gam[10] + m_gam[1];
+        J(5,3) = -m_gam[3]*x[5];
+        J(5,5) = -m_gam[0]*m_gam[10] - m_gam[3]*x[3];
+        for( size_t i=0 ; i<6 ; ++i )
+            dfdt[i] = 0.0;
+    }
+};
+
+class IFF_concat_MIN_jacobian {
+    vector<double> m_gam;
+public:
+    IFF_concat_MIN_jacobian( vector<double> &gam ) : m_gam(gam) { }
+    template< class State , class Matrix >
+    void operator() (const State &x, Matrix &J, const double t, State &dfdt) const {
+        J.clear();
+        J(0,0) = -m_gam[2];
+        J(0,5) = -m_gam[2];
+        J(1,0) = -m_gam[1] + m_gam[2];
+        J(1,1) = -m_gam[1];
+        J(1,3) = m_gam[3]*x[5];
+        J(1,5) = m_gam[2] + m_gam[3]*x[3];
+        J(2,2) = -x[5]*m_gam[4] - m_gam[5];
+        J(2,5) = m_gam[4]*(1.0-x[2]);
+        J(3,3) = -x[4]*m_gam[8] - m_gam[9];
+        J(3,4) = m_gam[8]*(1.0-x[3]);
+        J(4,2) = m_gam[6]*(1.0-x[4]);
+        J(4,4) = -x[2]*m_gam[6] - m_gam[7];
+        J(5,0) = m_gam[1];
+        J(5,1) = m_gam[1];
+        J(5,3) = -m_gam[3]*x[5];
+        J(5,5) = -m_gam[3]*x[3];
+        for( size_t i=0 ; i<6 ; ++i )
+            dfdt[i] = 0.0;
+    }
+};
+
+
+// Description of the model for the shared engine (../engine)
+struct IFF_concat {
+    typedef ::state_type state_type;
+    typedef IFF_concat_MAX system_on;
+    typedef IFF_concat_MIN system_off;
+    typedef IFF_concat_MAX_jacobian jacobian_on;
+    typedef IFF_concat_MIN_jacobian jacobian_off;
+    static const size_t output = 5;
+    static const bool stiff = true;
+    // x[0] + x[1] + x[5] (receptor total) is conserved by both systems
+    static const size_t n_conserved = 1;
+    static vector< vector<double> > conservation_laws() { return { {1.0, 1.0, 0.0, 0.0, 0.0, 1.0} }; }
+    // fast variables for the quasi-steady state reduction (x[0], x[1], x[5], receptor states)
+    static const size_t n_fast = 3;
+    static vector< size_t > fast_variables() { return { 0, 1, 5 }; }
+    // number of parameters (p0 followed by Amax)
+    static const size_t n_parameters = 11;
 };
\ No newline at end of file
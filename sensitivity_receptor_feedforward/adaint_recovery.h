@@ -4,6 +4,8 @@
 
 #include<boost/array.hpp>
 #include <boost/numeric/odeint.hpp>
+#include "../engine/workspace.h"
+#include "../engine/counters.h"
 #include "system.h"
 
 
@@ -17,24 +19,11 @@ const double ton = 1.0;
 
 typedef boost::array< double , 6 > state_type;
 
-struct push_back_state_and_time
-{
-    std::vector< state_type >& m_states;
-    std::vector< double >& m_times;
-
-    push_back_state_and_time( std::vector< state_type > &states , std::vector< double > &times )
-    : m_states( states ) , m_times( times ) { }
-
-    void operator()( const state_type &x_recov , double t )
-    {
-        m_states.push_back( x_recov );
-        m_times.push_back( t );
-    }
-};
-
-
-double adaint_recovery(vector<double> &result, double T,  double Amax, const vector<double> &p0, int print, const char* fnm, int recovery_true)
+// w holds the trajectories, it is reset here and keeps its memory for the next call
+double adaint_recovery(vector<double> &result, double T,  double Amax, const vector<double> &p0, int print, const char* fnm, int recovery_true, adaint_workspace< 6 > &w)
 {
+    counted_scope call( adaint_recovery_call );
+    w.reset();
     vector<double> full_param;
     for( int i=0 ; i<p0.size() ; ++i )
         {
@@ -42,8 +31,8 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
         }
 
     full_param.push_back(Amax);
-    IFF_concat_MAX sys(full_param);
-    IFF_concat_MIN sys2(full_param);
+    counted_rhs< IFF_concat_MAX > sys(full_param);
+    counted_rhs< IFF_concat_MIN > sys2(full_param);
 
 
     runge_kutta4< state_type > rk4; 
@@ -54,40 +43,38 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
     
 
     state_type x = { 1.0 , 0.0 , 0.0 , 0.0, 0.0, 0.0};
-    vector<state_type> x_vec;
-    vector<double> times;
-    vector<double> output_variable;
+    trajectory_columns< 6 > &trajectory = w.trajectory;
+    const chunked_column &output_variable = trajectory.x[5];
 
 
-    vector<double> peaks_time;
-    vector<double> peaks_level; 
+    vector<double> &peaks_time = w.peaks_time;
+    vector<double> &peaks_level = w.peaks_level; 
     int nro_picos;
     double int_threshold = 0.01;
     double t = 0.0;
     
 
-    times.push_back(t);
-    x_vec.push_back(x);
-    output_variable.push_back(x[5]);
+    trajectory.push_back(x, t);
     int ht = 0;
     double min_peak_height = 0.0;
     double max_peak_height = 1.0;
     
     
+    counted_scope habituation( habituation_phase );
     while (t <= max_integration_time)
     {
         ht+=1;
+        count_event( period_count );
         for( size_t i=0 ; i<Ton_duration ; ++i )
         {
             rk4.do_step( sys , x , t , step_size);
             t += step_size;
-            times.push_back(t);
-            x_vec.push_back(x);
-            output_variable.push_back(x[5]);
+            trajectory.push_back(x, t);
         }
         
         if (  (std::any_of(x.begin(), x.end(), [max_peak_height](double y) { return y > max_peak_height; })) || (std::any_of(x.begin(), x.end(), [](double d) { return std::isnan(d); } )) )
         {
+            count_event( rejection_count );
             return 60.0;
             break;
         }
@@ -96,21 +83,20 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
         {
             rk4.do_step( sys2 , x , t , step_size);
             t += step_size;
-            times.push_back(t);
-            x_vec.push_back(x);
-            output_variable.push_back(x[5]);
+            trajectory.push_back(x, t);
         }
 
         if (  (std::any_of(x.begin(), x.end(), [max_peak_height](double y) { return y > max_peak_height; })) || (std::any_of(x.begin(), x.end(), [](double d) { return std::isnan(d); } )) )
         {
+            count_event( rejection_count );
             return 60.0;
             break;
         }
 
         //  max element
-        int row = (max_element(output_variable.end()-Ton_duration-Toff_duration, output_variable.end()) - output_variable.begin());
+        int row = output_variable.max_index(output_variable.size()-Ton_duration-Toff_duration, output_variable.size());
         peaks_level.push_back(output_variable[row]);
-        peaks_time.push_back(times[row]);
+        peaks_time.push_back(trajectory.times[row]);
 
         nro_picos = peaks_time.size(); 
         if (nro_picos >= 2)
@@ -121,35 +107,29 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
             }
         }
     }
+    habituation.stop();
     
     result[0] = ht - 1;
     if (print)
     {
         std::ofstream myfile;
         myfile.open(fnm);
-        for( size_t i=0; i<= (times.size()-1); i++ )
+        for( size_t i=0; i<= (trajectory.size()-1); i++ )
             {
-                myfile << times[i] << " ";
-                myfile << x_vec[i][0] << " ";
-                myfile << x_vec[i][1] << " ";
-                myfile << x_vec[i][2] << " ";
-                myfile << x_vec[i][3] << " ";
-                myfile << x_vec[i][4] << " ";
-                myfile << x_vec[i][5] << " ";
-                myfile << endl;
+                myfile << trajectory.times[i] << " ";
+                myfile << trajectory.x[0][i] << " ";
+                myfile << trajectory.x[1][i] << " ";
+                myfile << trajectory.x[2][i] << " ";
+                myfile << trajectory.x[3][i] << " ";
+                myfile << trajectory.x[4][i] << " ";
+                myfile << trajectory.x[5][i] << " ";
+                myfile << "\n";
             }
         myfile.close();
     }
 
-    vector<state_type> n_x_vec;
-    vector<double> n_times;
-    vector<double> n_output_variable;
-    for( size_t i=0 ; i<times.size()-Ton_duration-Toff_duration -1; ++i )
-        {
-            n_times.push_back(times[i]);
-            n_x_vec.push_back(x_vec[i]);
-            n_output_variable.push_back(output_variable[i]);
-        } 
+    // the recovery starts from the end of the last but one period
+    size_t last = trajectory.size()-Ton_duration-Toff_duration-2;
     
     
     // ------------------------------------
@@ -157,18 +137,19 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
     // ------------------------------------
     if ((recovery_true) && (result[0]<50))
     {
-        t = n_times[n_times.size()-1];
-        double tmax= T*pow(2,12) + n_times[n_times.size()-1];
-        state_type x_recov = n_x_vec[n_x_vec.size()-1];
+        counted_scope recovery( recovery_phase );
+        t = trajectory.times[last];
+        double tmax= T*pow(2,12) + trajectory.times[last];
+        state_type x_recov;
+        trajectory.state(last, x_recov);
         double first_peak = peaks_level[0]; 
 
         double step_size_big = 0.01;
 
-        vector<state_type> x_vec_recov;
-        vector<double> times_rec;
+        trajectory_columns< 6 > &x_vec_recov = w.recovery;
 
         
-        integrate_const(make_controlled( 1E-12 , 1E-12 , runge_kutta_dopri5< state_type >() ) , sys2 , x_recov , t , tmax , step_size_big, push_back_state_and_time( x_vec_recov , times_rec ) );
+        integrate_const(make_controlled( 1E-12 , 1E-12 , runge_kutta_dopri5< state_type >() ) , sys2 , x_recov , t , tmax , step_size_big, push_back_columns< 6 >( x_vec_recov ) );
         
 
     
@@ -179,9 +160,12 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
         
         while (dt > 0)
         {
-            state_type x_pert= x_vec_recov[resul_t+dt-1];
+            count_event( probe_count );
+            state_type x_pert;
+            x_vec_recov.state(resul_t+dt-1, x_pert);
             double t_pert = 0.0;
-            vector<double> output_variable_pert;
+            vector<double> &output_variable_pert = w.test_output;
+            output_variable_pert.clear();
             
             for( size_t i=0 ; i<Ton_duration ; ++i )
             {
@@ -192,6 +176,7 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
             
             if (  (std::any_of(x_pert.begin(), x_pert.end(), [max_peak_height](double y) { return y > max_peak_height; })) || (std::any_of(x_pert.begin(), x_pert.end(), [](double d) { return std::isnan(d); } )) )
             {
+                count_event( rejection_count );
                 return 60.0;
                 break;
             }
@@ -205,6 +190,7 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
 
             if (  (std::any_of(x_pert.begin(), x_pert.end(), [max_peak_height](double y) { return y > max_peak_height; })) || (std::any_of(x_pert.begin(), x_pert.end(), [](double d) { return std::isnan(d); } )) )
             {
+                count_event( rejection_count );
                 return 60.0;
                 break;
             }
@@ -231,4 +217,10 @@ double adaint_recovery(vector<double> &result, double T,  double Amax, const vec
         result[1] = -1;
     }
     return (double)(ht-1); 
-}
\ No newline at end of file
+}
+
+
+double adaint_recovery(vector<double> &result, double T,  double Amax, const vector<double> &p0, int print, const char* fnm, int recovery_true)
+{
+    return adaint_recovery(result, T, Amax, p0, print, fnm, recovery_true, thread_workspace< 6 >());
+}
@@ -3,6 +3,7 @@
 #include<boost/array.hpp>
 
 #include "sensitivity.h"
+#include "../engine/parameter_loader.h"
 
 using namespace std;
 
@@ -14,30 +15,17 @@ using namespace std;
 
 int main()
 {    
-    vector<double> geny(9);
-    ifstream testFile("/Users/Maria/Desktop/phd/habituation/sensitivity_receptor_feedforward/system_single.txt");    
-    string line;
-    
-    while(getline(testFile, line)){
-        std::replace(line.begin(), line.end(), ',', ' ');
-
-        stringstream ss(line);
-        ss >> geny[0];
-        ss >> geny[1];
-        ss >> geny[2];
-        ss >> geny[3];
-        ss >> geny[4];
-        ss >> geny[5];
-        ss >> geny[6];
-        ss >> geny[7];
-        ss >> geny[8];
-        
-        
+    parameter_table table;
+    if( !load_model_parameters< IFF_concat >( table , "/Users/Maria/Desktop/phd/habituation/sensitivity_receptor_feedforward/system_single.txt" ) )
+        return 1;
+
+    for( size_t i=0 ; i<table.rows() ; ++i )
+    {
+        vector<double> geny = table.row_vector( i );
 
         string ff = "sensitivity_receptor_feedforward_.txt";
         const char* filename = ff.data();
         int sens_analy = sensitivity(geny, filename);
     }
-    testFile.close();
     return 0;   
 }
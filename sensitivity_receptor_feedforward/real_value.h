@@ -28,6 +28,7 @@ vector<double> divideByNextElement(vector<double>& input) {
 
 int real_value(const vector<double> &geny, int print)
 {
+    counted_scope call( real_value_call );
     double valor;
     vector<double> periods(3);
     vector<double> amplitudes(3);
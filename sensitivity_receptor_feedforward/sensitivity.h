@@ -8,6 +8,7 @@ using namespace std;
 
 int sensitivity(const vector<double> &geny, const char* fnm)
 {
+    counted_scope call( sensitivity_call );
     int param_len = geny.size();
     const size_t rowsize = param_len;
     const size_t columnsize = 2;